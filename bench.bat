@@ -0,0 +1,4 @@
+cd ./src
+g++ -std=c++23 -O2 ./bench.cpp ./ilbuilder.cpp ./binary.cpp ./decoder.cpp ./jit.cpp ./heap.cpp ./arena.cpp ./optimizer.cpp ./trace.cpp ./profile.cpp ./batch.cpp ./scheduler.cpp ./snapshot.cpp ./pages.cpp ./bytecode.cpp ./operand.cpp ./assembler.cpp ./verifier.cpp ./aot.cpp ./interrupt.cpp -pthread -o ../out/cemu-bench.exe
+cd ../
+./out/cemu-bench.exe %*
\ No newline at end of file
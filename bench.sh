@@ -0,0 +1,5 @@
+#!/usr/bin/sh
+cd ./src
+g++ -std=c++23 -O2 ./bench.cpp ./ilbuilder.cpp ./binary.cpp ./decoder.cpp ./jit.cpp ./heap.cpp ./arena.cpp ./optimizer.cpp ./trace.cpp ./profile.cpp ./batch.cpp ./scheduler.cpp ./snapshot.cpp ./pages.cpp ./bytecode.cpp ./operand.cpp ./assembler.cpp ./verifier.cpp ./aot.cpp ./interrupt.cpp -pthread -ldl -o ../out/cemu-bench
+cd ../
+./out/cemu-bench "$@"
\ No newline at end of file
@@ -1,4 +1,4 @@
 cd ./src
-g++ -std=c++23 -g ./main.cpp ./ilbuilder.cpp ./binary.cpp -o ../out/cemu.exe
+g++ -std=c++23 -g ./main.cpp ./ilbuilder.cpp ./binary.cpp ./decoder.cpp ./jit.cpp ./heap.cpp ./arena.cpp ./optimizer.cpp ./trace.cpp ./profile.cpp ./batch.cpp ./scheduler.cpp ./snapshot.cpp ./pages.cpp ./bytecode.cpp ./operand.cpp ./assembler.cpp ./verifier.cpp ./aot.cpp ./interrupt.cpp -pthread -o ../out/cemu.exe
 cd ../
 ./out/cemu.exe
\ No newline at end of file
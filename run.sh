@@ -1,5 +1,5 @@
 #!/usr/bin/sh
 cd ./src
-g++ -std=c++23 -g ./main.cpp ./ilbuilder.cpp ./binary.cpp -o ../out/cemu
+g++ -std=c++23 -g ./main.cpp ./ilbuilder.cpp ./binary.cpp ./decoder.cpp ./jit.cpp ./heap.cpp ./arena.cpp ./optimizer.cpp ./trace.cpp ./profile.cpp ./batch.cpp ./scheduler.cpp ./snapshot.cpp ./pages.cpp ./bytecode.cpp ./operand.cpp ./assembler.cpp ./verifier.cpp ./aot.cpp ./interrupt.cpp -pthread -ldl -o ../out/cemu
 cd ../
 ./out/cemu
\ No newline at end of file
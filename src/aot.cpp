@@ -0,0 +1,462 @@
+#include "aot.h"
+
+#if CEMU_HAS_AOT
+#include <string>
+#include <chrono>
+#include <cstdarg>
+#include <errno.h>
+#include <dlfcn.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+// the generated module keeps every guest register in a local for the whole
+// call, so the host compiler can hold them in host registers. they are read
+// from cpu_t::registers on entry and written back on every exit. guest
+// memory is only touched by PUSH/POP and LOAD/STORE, through memcpy, in
+// native byte order like the interpreter's words.
+static const char* register_locals[REGISTER_SIZE] = {
+    "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "pc", "sp", "px", "zf", "sf",
+};
+
+static bool is_register(int idx) { return idx >= 0 && idx < REGISTER_SIZE; }
+
+static void emit(std::string* out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void emit(std::string* out, const char* format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    out->append(line);
+}
+
+static const char* alu_operator(unsigned char type) {
+    switch (type) {
+        case ADD: case ADDI: return "+";
+        case SUB: case SUBI: return "-";
+        case MUL: case MULI: return "*";
+        case DIV: case DIVI: return "/";
+        case AND: case ANDI: return "&";
+        case OR:  case ORI:  return "|";
+    }
+    return "^";
+}
+
+// leaves instruction 'idx' to the interpreter
+static void emit_bail(std::string* out, int idx) {
+    emit(out, "    { result = %d; goto out; }\n", idx);
+}
+
+// end of a basic block, leave at the target once the budget is spent
+static void emit_taken_jump(std::string* out, int target) {
+    emit(out, "    if (n >= budget)"); emit_bail(out, target);
+    emit(out, "    goto i%d;\n", target);
+}
+
+// the C for one instruction, the checks mirror the jit's. returns false if
+// the instruction has to be left to the interpreter. 'checked' instructions
+// can still bail at run time, and the interpreter continues after them.
+static bool emit_instruction(std::string* out, const op_decoded_t* inst, int idx, bool verified, bool* checked) {
+    const int* operands = inst->operands;
+    (*checked) = false;
+
+    switch (inst->type) {
+        case PUSH: {
+            if (inst->length != 1)
+                break;
+
+            if (!verified) {
+                (*checked) = true;
+                emit(out, "    if (sp >= %d)", STACK_SIZE); emit_bail(out, idx);
+            }
+            emit(out, "    n++; t = (u32)%d; __builtin_memcpy(m + sp, &t, 4); sp += 4;\n", operands[0]);
+            return true;
+        }
+
+        case POP: {
+            if (inst->length != 1 || !is_register(operands[0]))
+                break;
+
+            if (!verified) {
+                (*checked) = true;
+                emit(out, "    if (sp < 4 || sp > %d)", STACK_SIZE); emit_bail(out, idx);
+            }
+            emit(out, "    n++; sp -= 4; __builtin_memcpy(&t, m + sp, 4); %s = t;\n", register_locals[operands[0]]);
+            return true;
+        }
+
+        case MOVI: {
+            if (inst->length != 2 || !is_register(operands[0]))
+                break;
+
+            // the interpreter replays the push/pop on overflow
+            if (!verified) {
+                (*checked) = true;
+                emit(out, "    if (sp >= %d)", STACK_SIZE); emit_bail(out, idx);
+            }
+            emit(out, "    n++; %s = (u32)%d;\n", register_locals[operands[0]], operands[1]);
+            return true;
+        }
+
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case AND:
+        case OR:
+        case XOR: {
+            if (inst->length != 2 || !is_register(operands[0]) || !is_register(operands[1]))
+                break;
+
+            // registers are unsigned, so DIV is an unsigned divide like the interpreter's.
+            // a 0 divisor goes back to the interpreter, which reports it
+            if (inst->type == DIV) {
+                (*checked) = true;
+                emit(out, "    if (%s == 0)", register_locals[operands[1]]); emit_bail(out, idx);
+            }
+            emit(out, "    n++; %s %s= %s;\n", register_locals[operands[0]], alu_operator(inst->type), register_locals[operands[1]]);
+            return true;
+        }
+
+        case ADDI:
+        case SUBI:
+        case MULI:
+        case DIVI:
+        case ANDI:
+        case ORI:
+        case XORI: {
+            // dividing by 0 is left to the interpreter, which reports it
+            if (inst->length != 2 || !is_register(operands[0]) || (inst->type == DIVI && operands[1] == 0))
+                break;
+
+            emit(out, "    n++; %s %s= (u32)%d;\n", register_locals[operands[0]], alu_operator(inst->type), operands[1]);
+            return true;
+        }
+
+        case LOAD:
+        case STORE: {
+            if (inst->length != 3 || !is_register(operands[0]) || !is_register(operands[1]))
+                break;
+
+            // an address outside guest memory goes back to the interpreter, which reports it
+            (*checked) = true;
+            emit(out, "    t = %s + (u32)%d;\n", register_locals[operands[1]], operands[2]);
+            emit(out, "    if (t > limit)"); emit_bail(out, idx);
+            if (inst->type == LOAD) {
+                emit(out, "    n++; __builtin_memcpy(&%s, m + t, 4);\n", register_locals[operands[0]]);
+            } else {
+                emit(out, "    n++; __builtin_memcpy(m + t, &%s, 4);\n", register_locals[operands[0]]);
+            }
+            return true;
+        }
+
+        // zf/sf are locals like every register, the host compiler drops the
+        // stores nothing reads before the next compare or the way out
+        case CMP: {
+            if (inst->length != 2 || !is_register(operands[0]) || !is_register(operands[1]))
+                break;
+
+            emit(out, "    n++; zf = %s == %s; sf = (%s - %s) >> 31;\n", register_locals[operands[0]], register_locals[operands[1]],
+                 register_locals[operands[0]], register_locals[operands[1]]);
+            return true;
+        }
+
+        case JMP: {
+            emit(out, "    n++;\n");
+            if (inst->length == 1 && inst->target >= 0) {
+                emit_taken_jump(out, inst->target);
+            }
+            return true;
+        }
+
+        case JE:
+        case JNE: {
+            emit(out, "    n++;\n");
+            if (inst->length == 1 && inst->target >= 0) {
+                emit(out, "    if (%szf) {\n", inst->type == JE ? "" : "!");
+                emit_taken_jump(out, inst->target);
+                emit(out, "    }\n");
+            }
+            return true;
+        }
+
+        case CMPJE:
+        case CMPJNE: {
+            if (inst->length != 3 || !is_register(operands[0]) || !is_register(operands[1]))
+                break;
+
+            emit(out, "    n++; zf = %s == %s; sf = (%s - %s) >> 31;\n", register_locals[operands[0]], register_locals[operands[1]],
+                 register_locals[operands[0]], register_locals[operands[1]]);
+            if (inst->target >= 0) {
+                emit(out, "    if (%szf) {\n", inst->type == CMPJE ? "" : "!");
+                emit_taken_jump(out, inst->target);
+                emit(out, "    }\n");
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// the whole program as one C function. it can be entered at the first
+// instruction, at every jump target and after every instruction that can
+// bail, which is everywhere the cpu resumes it in practice.
+static std::string translate(const op_decoded_program_t* program, int* compiled) {
+    const int length = program->length;
+    bool* entries = (bool*)calloc(length + 1, sizeof(bool));
+    size_t* starts = (size_t*)malloc(sizeof(size_t) * (length + 1));        // of every instruction's code in 'body'
+    std::string body;
+    std::string out;
+
+    entries[0] = true;
+    (*compiled) = 0;
+    for (int i = 0; i < length; ++i) {
+        const op_decoded_t* inst = &program->instructions[i];
+        if (inst->target >= 0) {
+            entries[inst->target] = true;
+        }
+    }
+
+    for (int i = 0; i < length; ++i) {
+        bool checked;
+        starts[i] = body.length();
+        if (emit_instruction(&body, &program->instructions[i], i, program->verified, &checked)) {
+            (*compiled)++;
+        } else {
+            emit_bail(&body, i);
+            checked = true;
+        }
+        if (checked) {
+            entries[i + 1] = true;
+        }
+    }
+    starts[length] = body.length();
+
+    emit(&out, "/* cemu aot module, abi %d, %d instructions%s */\n", AOT_ABI_VERSION, length, program->verified ? ", verified" : "");
+    emit(&out, "typedef unsigned int u32;\n");
+    emit(&out, "int cemu_aot_version = %d;\n\n", AOT_ABI_VERSION);
+    emit(&out, "int cemu_aot_entry(u32* registers, unsigned char* m, int start, u32* cycles, u32 budget, u32 memory_size) {\n");
+    for (int r = 0; r < REGISTER_SIZE; ++r) {
+        emit(&out, "    u32 %s = registers[%d];\n", register_locals[r], r);
+    }
+    emit(&out, "    u32 n = 0, t;\n");
+    emit(&out, "    const u32 limit = memory_size - 4;\n");
+    emit(&out, "    int result;\n");
+    emit(&out, "    switch (start) {\n");
+    for (int i = 0; i < length; ++i) {
+        if (entries[i]) {
+            emit(&out, "        case %d: goto i%d;\n", i, i);
+        }
+    }
+    emit(&out, "        default: return start;\n");
+    emit(&out, "    }\n");
+
+    // labels only go on entries, the rest is straight-line code the compiler can merge
+    for (int i = 0; i < length; ++i) {
+        if (entries[i]) {
+            emit(&out, "i%d:\n", i);
+        }
+        out.append(body, starts[i], starts[i + 1] - starts[i]);
+    }
+
+    // falling off the end (or jumping to it) finishes the program
+    emit(&out, "i%d:\n", length);
+    emit(&out, "    result = %d;\n", length);
+    emit(&out, "out:\n");
+    for (int r = 0; r < REGISTER_SIZE; ++r) {
+        emit(&out, "    registers[%d] = %s;\n", r, register_locals[r]);
+    }
+    emit(&out, "    *cycles += n;\n");
+    emit(&out, "    return result;\n");
+    emit(&out, "}\n");
+
+    free(entries);
+    free(starts);
+    return out;
+}
+
+// fnv-1a, the module name. the source already says everything about the
+// program and the abi, so equal sources can share one module
+static unsigned long long hash_source(const std::string& source) {
+    unsigned long long hash = 0xCBF29CE484222325ull;
+    for (unsigned char c : source) {
+        hash = (hash ^ c) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// $CEMU_AOT_CACHE, $XDG_CACHE_HOME/cemu-aot, ~/.cache/cemu-aot or /tmp/cemu-aot-<uid>,
+// created if missing. whatever is in it gets dlopen()ed, so it has to be a
+// directory of this user's that nobody else can write to
+static bool cache_directory(std::string* dir) {
+    const char* env;
+    if ((env = getenv("CEMU_AOT_CACHE")) != NULL && env[0] != '\0') {
+        (*dir) = env;
+    } else if ((env = getenv("XDG_CACHE_HOME")) != NULL && env[0] != '\0') {
+        (*dir) = std::string(env) + "/cemu-aot";
+    } else if ((env = getenv("HOME")) != NULL && env[0] != '\0') {
+        (*dir) = std::string(env) + "/.cache/cemu-aot";
+    } else {
+        (*dir) = "/tmp/cemu-aot-" + std::to_string(geteuid());
+    }
+
+    for (size_t slash = dir->find('/', 1); slash != std::string::npos; slash = dir->find('/', slash + 1)) {
+        if (mkdir(dir->substr(0, slash).c_str(), 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    if (mkdir(dir->c_str(), 0700) != 0 && errno != EEXIST) {
+        return false;
+    }
+
+    struct stat info;
+    if (stat(dir->c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != geteuid()) {
+        LOG_WARN("[!] AOT cache " << *dir << " is not a directory owned by this user, not using it");
+        return false;
+    }
+
+    // a cache made before this check may still be open to others, it's ours so close it
+    if ((info.st_mode & 077) != 0 && chmod(dir->c_str(), 0700) != 0) {
+        LOG_WARN("[!] AOT cache " << *dir << " is open to other users and can't be made private, not using it");
+        return false;
+    }
+    return true;
+}
+
+static bool write_file(const std::string& path, const std::string& contents) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+
+    const bool ok = fwrite(contents.data(), 1, contents.length(), file) == contents.length();
+    return fclose(file) == 0 && ok;
+}
+
+// builds 'source' into the shared object at 'path'. it's written next to it
+// under a per-process name and renamed into place, so another cemu building
+// the same module at the same time never sees half a file
+static bool build_module(const std::string& source, const std::string& path) {
+    const char* compiler = getenv("CEMU_AOT_CC");
+    if (compiler == NULL || compiler[0] == '\0') {
+        compiler = "cc";
+    }
+
+    const std::string stem = path + "." + std::to_string(getpid());
+    const std::string c_path = stem + ".c";
+    const std::string so_path = stem + ".so";
+    if (!write_file(c_path, source)) {
+        LOG_ERROR("[-] aot_compile() failed to write " << c_path);
+        return false;
+    }
+
+    const char* argv[] = { compiler, "-O2", "-shared", "-fPIC", "-w", "-o", so_path.c_str(), c_path.c_str(), NULL };
+    pid_t pid;
+    int status = -1;
+    if (posix_spawnp(&pid, compiler, NULL, NULL, (char* const*)argv, environ) != 0) {
+        LOG_ERROR("[-] aot_compile() could not run '" << compiler << "', set CEMU_AOT_CC");
+    } else {
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if (status != 0) {
+            LOG_ERROR("[-] aot_compile() '" << compiler << "' failed on the generated module");
+        }
+    }
+
+    unlink(c_path.c_str());
+    if (status != 0) {
+        unlink(so_path.c_str());
+        return false;
+    }
+
+    if (rename(so_path.c_str(), path.c_str()) != 0) {
+        LOG_ERROR("[-] aot_compile() failed to move the module to " << path);
+        unlink(so_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool load_module(const std::string& path, aot_program_t* aot) {
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+        return false;
+
+    const int* version = (const int*)dlsym(handle, "cemu_aot_version");
+    void* entry = dlsym(handle, "cemu_aot_entry");
+    if (version == NULL || *version != AOT_ABI_VERSION || entry == NULL) {
+        dlclose(handle);
+        return false;
+    }
+
+    aot->handle = handle;
+    aot->entry = (aot_entry_t)entry;
+    return true;
+}
+
+aot_program_t* aot_compile(const op_decoded_program_t* program) {
+    if (program == NULL)
+        return NULL;
+
+    std::string dir;
+    if (!cache_directory(&dir)) {
+        LOG_ERROR("[-] aot_compile() has no cache directory, set CEMU_AOT_CACHE");
+        return NULL;
+    }
+
+    int compiled;
+    const std::string source = translate(program, &compiled);
+    const unsigned long long hash = hash_source(source);
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.so", hash);
+    const std::string path = dir + name;
+
+    aot_program_t* aot = (aot_program_t*)malloc(sizeof(aot_program_t));
+    if (aot == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for aot_program_t");
+        return NULL;
+    }
+    aot->length = program->length;
+    aot->hash = hash;
+    aot->compiled = compiled;
+
+    // a cached module that doesn't load (truncated, other abi) is rebuilt once
+    if (load_module(path, aot)) {
+        LOG_MSG("[+] AOT loaded " << compiled << "/" << program->length << " instructions from " << path);
+        return aot;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    if (!build_module(source, path) || !load_module(path, aot)) {
+        LOG_ERROR("[-] aot_compile() failed to build " << path);
+        free(aot);
+        return NULL;
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    LOG_MSG("[+] AOT compiled " << compiled << "/" << program->length << " instructions to " << path << " (" << elapsed.count() << " ms)");
+    return aot;
+}
+
+void aot_free(aot_program_t* aot) {
+    if (aot == NULL)
+        return;
+
+    dlclose(aot->handle);
+    free(aot);
+}
+
+#else
+
+aot_program_t* aot_compile(const op_decoded_program_t* program) {
+    LOG_WARN("[!] AOT is not available on this platform");
+    return NULL;
+}
+
+void aot_free(aot_program_t* aot) {}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __AOT_H__
+#define __AOT_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "opcodes.h"
+#include "decoder.h"
+#include "machine.h"
+
+// the aot engine translates a decoded program into one C function, has the
+// host compiler build it into a shared object and dlopen()s that, so it
+// needs posix_spawn and dlopen. everything else keeps using the interpreter.
+#if defined(__unix__) || defined(__APPLE__)
+#define CEMU_HAS_AOT 1
+#else
+#define CEMU_HAS_AOT 0
+#endif
+
+// bump when the generated code or the entry point changes, old modules in
+// the cache are then never looked up again
+static constexpr int AOT_ABI_VERSION = 3;
+
+// native entry, same contract as jit_entry_t but entered by instruction index:
+// runs from 'start' until it reaches the end of the program, an instruction
+// it left to the interpreter, or a taken jump after 'budget' instructions, and
+// returns the index of the instruction it stopped at (not executed yet). an
+// index the module has no entry for comes straight back.
+typedef int (*aot_entry_t)(unsigned int* registers, unsigned char* memory, int start, unsigned int* cycles,
+                           unsigned int budget, unsigned int memory_size);
+
+typedef struct aot_program_t {
+  void* handle;                             // dlopen() handle
+  aot_entry_t entry;
+  int length;
+  unsigned long long hash;                  // of the generated source, names the cached module
+  int compiled;                             // number of instructions translated to C
+};
+
+// modules are cached by hash under $CEMU_AOT_CACHE (default ~/.cache/cemu-aot),
+// a program seen before is only dlopen()ed. the directory has to belong to
+// the current user and is kept at mode 0700. $CEMU_AOT_CC picks the compiler
+// (default "cc"). returns NULL after logging why when there is no module.
+aot_program_t* aot_compile(const op_decoded_program_t* program);
+void aot_free(aot_program_t* aot);
+
+#endif // __AOT_H__
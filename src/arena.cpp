@@ -0,0 +1,73 @@
+#include "arena.h"
+
+static unsigned char* chunk_data(arena_chunk_t* chunk) {
+    return reinterpret_cast<unsigned char*>(chunk + 1);
+}
+
+static arena_chunk_t* create_chunk(size_t capacity) {
+    arena_chunk_t* chunk = (arena_chunk_t*)malloc(sizeof(arena_chunk_t) + capacity);
+    if (chunk == NULL) {
+        LOG_ERROR("[-] Failed to allocate arena chunk of " << capacity << " bytes");
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->used = 0;
+    chunk->capacity = capacity;
+    return chunk;
+}
+
+void* arena_t::alloc(size_t size, size_t align) {
+    if (head != NULL) {
+        const uintptr_t base = reinterpret_cast<uintptr_t>(chunk_data(head));
+        const size_t start = ((base + head->used + align - 1) & ~(uintptr_t)(align - 1)) - base;
+        if (start + size <= head->capacity) {
+            head->used = start + size;
+            total += size;
+            return chunk_data(head) + start;
+        }
+    }
+
+    // new chunk, oversized requests get a chunk of their own
+    arena_chunk_t* chunk = create_chunk(std::max(ARENA_CHUNK_SIZE, size + align));
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    chunk->next = head;
+    head = chunk;
+    return alloc(size, align);
+}
+
+void* arena_t::copy(const void* data, size_t size, size_t align) {
+    void* ptr = alloc(size, align);
+    if (ptr != NULL && size > 0) {
+        memcpy(ptr, data, size);
+    }
+    return ptr;
+}
+
+arena_t* create_arena() {
+    arena_t* arena = (arena_t*)malloc(sizeof(arena_t));
+    if (arena == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for arena_t");
+        return NULL;
+    }
+
+    arena->head = NULL;
+    arena->total = 0;
+    return arena;
+}
+
+void free_arena(arena_t* arena) {
+    if (arena == NULL)
+        return;
+
+    arena_chunk_t* chunk = arena->head;
+    while (chunk != NULL) {
+        arena_chunk_t* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "stdafx.h"
+#include "log.h"
+
+#include <cstddef>
+
+static constexpr size_t ARENA_CHUNK_SIZE = 64 * 1024;
+
+typedef struct arena_chunk_t {
+  arena_chunk_t* next;
+  size_t used;
+  size_t capacity;
+};
+
+// bump allocator. memory is handed out of large chunks and only ever
+// given back all at once with free_arena().
+typedef struct arena_t {
+  arena_chunk_t* head;
+  size_t total;                             // bytes handed out so far
+
+  void* alloc(size_t size, size_t align = alignof(std::max_align_t));
+  void* copy(const void* data, size_t size, size_t align = alignof(std::max_align_t));
+};
+
+arena_t* create_arena();
+void free_arena(arena_t* arena);
+
+#endif // __ARENA_H__
\ No newline at end of file
@@ -0,0 +1,492 @@
+#include "assembler.h"
+#include "operand.h"
+
+#include <string_view>
+
+static constexpr int INSTRUCTION_HEADER_SIZE = sizeof(unsigned char) + sizeof(int);
+static constexpr unsigned int LABEL_TABLE_INITIAL_SIZE = 256;                // power of two
+
+// up to 8 characters, lowercased, packed into one integer so a mnemonic
+// lookup is a handful of integer compares
+static constexpr unsigned long long mnemonic_key(const char* name, size_t length) {
+    unsigned long long key = 0;
+    for (size_t i = 0; i < length; ++i) {
+        key |= (unsigned long long)(unsigned char)(name[i] | 0x20) << (i * 8);
+    }
+    return key;
+}
+
+// operand kinds, one character per operand: 'r' register, 'i' immediate,
+// 't' jump target (a label or a byte offset), 'm' memory ([reg + offset],
+// written as two operands: the register and the offset)
+typedef struct asm_mnemonic_t {
+  const char* name;
+  op_type_t type;
+  const char* operands;
+  unsigned long long key;
+};
+
+#define MNEMONIC(name, type, operands) { name, type, operands, mnemonic_key(name, sizeof(name) - 1) }
+
+static constexpr asm_mnemonic_t mnemonics[] = {
+    MNEMONIC("push", PUSH, "i"),  MNEMONIC("pop",  POP,  "r"),
+    MNEMONIC("add",  ADD,  "rr"), MNEMONIC("sub",  SUB,  "rr"),
+    MNEMONIC("mul",  MUL,  "rr"), MNEMONIC("div",  DIV,  "rr"),
+    MNEMONIC("or",   OR,   "rr"), MNEMONIC("xor",  XOR,  "rr"),
+    MNEMONIC("and",  AND,  "rr"), MNEMONIC("cmp",  CMP,  "rr"),
+    MNEMONIC("jmp",  JMP,  "t"),  MNEMONIC("je",   JE,   "t"),
+    MNEMONIC("jne",  JNE,  "t"),  MNEMONIC("int",  INT,  "i"),
+    MNEMONIC("movi", MOVI, "ri"),
+    MNEMONIC("addi", ADDI, "ri"), MNEMONIC("subi", SUBI, "ri"),
+    MNEMONIC("muli", MULI, "ri"), MNEMONIC("divi", DIVI, "ri"),
+    MNEMONIC("andi", ANDI, "ri"), MNEMONIC("ori",  ORI,  "ri"),
+    MNEMONIC("xori", XORI, "ri"),
+    MNEMONIC("load", LOAD, "rm"), MNEMONIC("store", STORE, "rm"),
+};
+
+#undef MNEMONIC
+
+// a jump operand written before its label was defined
+typedef struct asm_fixup_t {
+  asm_fixup_t* next;
+  size_t position;                          // of the operand in op_program_t::operands
+};
+
+typedef struct asm_label_t {
+  const char* name;
+  unsigned int length;
+  unsigned int hash;
+  int index;                                // instruction it names, -1 until it's defined
+  int offset;                               // byte offset of that instruction
+  int line;                                 // where it was defined, or first used while it isn't
+  asm_fixup_t* pending;
+  asm_label_t* next;                        // every label, in the order they were first seen
+};
+
+typedef struct assembler_t {
+  const char* name;
+  int line;
+  op_program_t* program;
+  arena_t* arena;
+
+  // open addressing, never more than half full. an outgrown table stays
+  // behind in the arena, which is at most as much as the live one.
+  asm_label_t** table;
+  unsigned int table_size;
+  int label_count;
+  int defined_count;
+  asm_label_t* first_label;
+  asm_label_t* last_label;
+};
+
+#define ASM_ERROR(as, msg) LOG_ERROR("[-] " << (as)->name << ":" << (as)->line << ": " << msg)
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool is_identifier_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '.';
+}
+
+static bool is_identifier(char c) {
+    return is_identifier_start(c) || (c >= '0' && c <= '9');
+}
+
+// fnv-1a
+static unsigned int hash_name(const char* name, size_t length) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static const asm_mnemonic_t* find_mnemonic(const char* name, size_t length) {
+    if (length == 0 || length > 8) {
+        return NULL;
+    }
+
+    const unsigned long long key = mnemonic_key(name, length);
+    for (const asm_mnemonic_t& mnemonic : mnemonics) {
+        if (mnemonic.key == key) {
+            return &mnemonic;
+        }
+    }
+    return NULL;
+}
+
+#pragma region Labels
+
+static bool grow_label_table(assembler_t* as) {
+    const unsigned int size = as->table_size == 0 ? LABEL_TABLE_INITIAL_SIZE : as->table_size * 2;
+    asm_label_t** table = (asm_label_t**)as->arena->alloc(sizeof(asm_label_t*) * size);
+    if (table == NULL) {
+        return false;
+    }
+    memset(table, 0, sizeof(asm_label_t*) * size);
+
+    for (asm_label_t* label = as->first_label; label != NULL; label = label->next) {
+        unsigned int slot = label->hash & (size - 1);
+        while (table[slot] != NULL) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = label;
+    }
+
+    as->table = table;
+    as->table_size = size;
+    return true;
+}
+
+// finds the label, or adds an undefined one
+static asm_label_t* intern_label(assembler_t* as, const char* name, size_t length) {
+    const unsigned int hash = hash_name(name, length);
+    unsigned int slot = hash & (as->table_size - 1);
+
+    for (asm_label_t* label; (label = as->table[slot]) != NULL; slot = (slot + 1) & (as->table_size - 1)) {
+        if (label->hash == hash && label->length == length && memcmp(label->name, name, length) == 0) {
+            return label;
+        }
+    }
+
+    asm_label_t* label = (asm_label_t*)as->arena->alloc(sizeof(asm_label_t));
+    char* copy = (char*)as->arena->alloc(length + 1, 1);
+    if (label == NULL || copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+
+    label->name = copy;
+    label->length = (unsigned int)length;
+    label->hash = hash;
+    label->index = -1;
+    label->offset = -1;
+    label->line = as->line;
+    label->pending = NULL;
+    label->next = NULL;
+
+    if (as->last_label != NULL) as->last_label->next = label;
+    else as->first_label = label;
+    as->last_label = label;
+    as->table[slot] = label;
+
+    if (++as->label_count * 2 > (int)as->table_size && !grow_label_table(as)) {
+        return NULL;
+    }
+    return label;
+}
+
+static bool define_label(assembler_t* as, const char* name, size_t length) {
+    asm_label_t* label = intern_label(as, name, length);
+    if (label == NULL) {
+        return false;
+    }
+    if (label->index >= 0) {
+        ASM_ERROR(as, "label '" << label->name << "' is already defined on line " << label->line);
+        return false;
+    }
+
+    op_program_t* program = as->program;
+    label->index = program->length;
+    label->offset = program->length * INSTRUCTION_HEADER_SIZE + (int)program->operands_length;
+    label->line = as->line;
+    as->defined_count++;
+
+    for (asm_fixup_t* fixup = label->pending; fixup != NULL; fixup = fixup->next) {
+        memcpy(&program->operands[fixup->position], &label->offset, sizeof(int));
+    }
+    label->pending = NULL;
+    return true;
+}
+
+#pragma endregion
+
+#pragma region Lines
+
+// one operand of kind 'kind', [str, str + length) is already trimmed.
+// 'position' is where its (first) int32 is going to land in the operand pool.
+static bool parse_operand(assembler_t* as, char kind, const char* str, size_t length, size_t position, int* value) {
+    operand_t operand;
+
+    if (kind == 'm') {
+        if (!get_operand_from_memory(str, length, &operand)) {
+            ASM_ERROR(as, "expected a memory operand like [r1 + 8], got '" << std::string_view(str, length) << "'");
+            return false;
+        }
+        value[0] = operand.value;
+        value[1] = operand.offset;
+        return true;
+    }
+
+    if (kind == 'r') {
+        if (!get_operand_from_register(str, length, &operand)) {
+            ASM_ERROR(as, "expected a register, got '" << std::string_view(str, length) << "'");
+            return false;
+        }
+        *value = operand.value;
+        return true;
+    }
+
+    if (kind == 't' && is_identifier_start(str[0])) {
+        for (size_t i = 1; i < length; ++i) {
+            if (!is_identifier(str[i])) {
+                ASM_ERROR(as, "bad label name '" << std::string_view(str, length) << "'");
+                return false;
+            }
+        }
+
+        asm_label_t* label = intern_label(as, str, length);
+        if (label == NULL) {
+            return false;
+        }
+        if (label->index >= 0) {
+            *value = label->offset;
+            return true;
+        }
+
+        asm_fixup_t* fixup = (asm_fixup_t*)as->arena->alloc(sizeof(asm_fixup_t));
+        if (fixup == NULL) {
+            return false;
+        }
+        fixup->position = position;
+        fixup->next = label->pending;
+        label->pending = fixup;
+        *value = -1;
+        return true;
+    }
+
+    if (!get_operand_from_auto(str, length, &operand) ||
+        (operand.type != OPERAND_INT && operand.type != OPERAND_HEX)) {
+        ASM_ERROR(as, "expected " << (kind == 't' ? "a label or an offset" : "an immediate") << ", got '"
+            << std::string_view(str, length) << "'");
+        return false;
+    }
+    *value = operand.value;
+    return true;
+}
+
+// cuts the comment off, ';' and '#' inside a quoted operand don't count
+static const char* strip_comment(const char* begin, const char* end) {
+    char quote = 0;
+    for (const char* c = begin; c < end; ++c) {
+        if (quote != 0) {
+            if (*c == '\\' && c + 1 < end) c++;
+            else if (*c == quote) quote = 0;
+        } else if (*c == '"' || *c == '\'') {
+            quote = *c;
+        } else if (*c == ';' || *c == '#') {
+            return c;
+        }
+    }
+    return end;
+}
+
+static bool assemble_line(assembler_t* as, const char* begin, const char* end) {
+    end = strip_comment(begin, end);
+
+    for (;;) {
+        while (begin < end && is_blank(*begin)) begin++;
+        while (end > begin && is_blank(end[-1])) end--;
+        if (begin == end) {
+            return true;
+        }
+
+        const char* word = begin;
+        if (!is_identifier_start(*begin)) {
+            ASM_ERROR(as, "expected a label or an instruction, got '" << std::string_view(begin, end - begin) << "'");
+            return false;
+        }
+        while (begin < end && is_identifier(*begin)) begin++;
+        const size_t word_length = (size_t)(begin - word);
+
+        const char* after = begin;
+        while (after < end && is_blank(*after)) after++;
+        if (after < end && *after == ':') {
+            if (!define_label(as, word, word_length)) {
+                return false;
+            }
+            begin = after + 1;
+            continue;                       // an instruction may follow on the same line
+        }
+
+        const asm_mnemonic_t* mnemonic = find_mnemonic(word, word_length);
+        if (mnemonic == NULL) {
+            ASM_ERROR(as, "unknown instruction '" << std::string_view(word, word_length) << "'");
+            return false;
+        }
+        if (begin < end && !is_blank(*begin)) {
+            ASM_ERROR(as, "expected whitespace after '" << mnemonic->name << "'");
+            return false;
+        }
+
+        const int expected = (int)strlen(mnemonic->operands);
+        const size_t base = as->program->operands_length;
+        int operands[ASSEMBLER_MAX_OPERANDS];
+        int count = 0;                      // operands in the source
+        int encoded = 0;                    // and in the bytecode, a memory operand is two
+
+        const char* cursor = after;
+        while (cursor < end) {
+            const char* comma = (const char*)memchr(cursor, ',', (size_t)(end - cursor));
+            const char* operand_end = comma != NULL ? comma : end;
+            const char* operand_begin = cursor;
+            while (operand_begin < operand_end && is_blank(*operand_begin)) operand_begin++;
+            const char* trimmed_end = operand_end;
+            while (trimmed_end > operand_begin && is_blank(trimmed_end[-1])) trimmed_end--;
+
+            if (operand_begin == trimmed_end) {
+                ASM_ERROR(as, "empty operand");
+                return false;
+            }
+            if (count == expected) {
+                ASM_ERROR(as, mnemonic->name << " takes " << expected << " operand(s)");
+                return false;
+            }
+            const char kind = mnemonic->operands[count];
+            if (!parse_operand(as, kind, operand_begin, (size_t)(trimmed_end - operand_begin),
+                               base + encoded * sizeof(int), &operands[encoded])) {
+                return false;
+            }
+            count++;
+            encoded += kind == 'm' ? 2 : 1;
+
+            if (comma == NULL) break;
+            cursor = comma + 1;
+            if (cursor == end) {
+                ASM_ERROR(as, "empty operand");
+                return false;
+            }
+        }
+
+        if (count != expected) {
+            ASM_ERROR(as, mnemonic->name << " takes " << expected << " operand(s)");
+            return false;
+        }
+
+        if (!append_instruction(as->program, mnemonic->type, encoded, operands, encoded * sizeof(int))) {
+            ASM_ERROR(as, "out of memory for the program");
+            return false;
+        }
+        return true;
+    }
+}
+
+#pragma endregion
+
+static void free_assembler(assembler_t* as) {
+    free_program(as->program);
+    free_arena(as->arena);
+}
+
+// labels that are still undefined, then the public list
+static bool finish_labels(assembler_t* as, assembly_t* assembly) {
+    for (asm_label_t* label = as->first_label; label != NULL; label = label->next) {
+        if (label->index < 0) {
+            as->line = label->line;
+            ASM_ERROR(as, "undefined label '" << label->name << "'");
+            return false;
+        }
+    }
+
+    assembly->labels = (program_label_t*)as->arena->alloc(sizeof(program_label_t) * std::max(as->defined_count, 1));
+    if (assembly->labels == NULL) {
+        return false;
+    }
+
+    int count = 0;
+    for (asm_label_t* label = as->first_label; label != NULL; label = label->next) {
+        assembly->labels[count].name = label->name;
+        assembly->labels[count].index = label->index;
+        count++;
+    }
+    assembly->label_count = count;
+    return true;
+}
+
+assembly_t* assemble(FILE* source, const char* name) {
+    assembler_t as = {};
+    as.name = name;
+    as.program = create_program();
+    as.arena = create_arena();
+    char* buffer = (char*)malloc(ASSEMBLER_LINE_MAX);
+    if (as.program == NULL || as.arena == NULL || buffer == NULL || !grow_label_table(&as)) {
+        LOG_ERROR("[-] Failed to allocate memory for the assembler");
+        free(buffer);
+        free_assembler(&as);
+        return NULL;
+    }
+
+    // whole lines are assembled out of the buffer, a partial one at the end
+    // is moved to the front and completed by the next read
+    size_t filled = 0;
+    bool ok = true;
+    for (bool eof = false; ok && !eof;) {
+        const size_t read = fread(buffer + filled, 1, ASSEMBLER_LINE_MAX - filled, source);
+        filled += read;
+        eof = read == 0;
+
+        size_t start = 0;
+        for (const char* newline; ok && (newline = (const char*)memchr(buffer + start, '\n', filled - start)) != NULL;) {
+            as.line++;
+            ok = assemble_line(&as, buffer + start, newline);
+            start = (size_t)(newline - buffer) + 1;
+        }
+
+        if (ok && eof && start < filled) {
+            as.line++;
+            ok = assemble_line(&as, buffer + start, buffer + filled);
+        } else if (ok && start == 0 && filled == ASSEMBLER_LINE_MAX) {
+            as.line++;
+            ASM_ERROR(&as, "line is longer than " << ASSEMBLER_LINE_MAX << " bytes");
+            ok = false;
+        }
+
+        memmove(buffer, buffer + start, filled - start);
+        filled -= start;
+    }
+    free(buffer);
+
+    if (ok && ferror(source)) {
+        LOG_ERROR("[-] Failed to read assembly source: " << name);
+        ok = false;
+    }
+
+    assembly_t* assembly = ok ? (assembly_t*)malloc(sizeof(assembly_t)) : NULL;
+    if (assembly == NULL || !finish_labels(&as, assembly)) {
+        free(assembly);
+        free_assembler(&as);
+        return NULL;
+    }
+
+    assembly->program = as.program;
+    assembly->lines = as.line;
+    assembly->arena = as.arena;
+    return assembly;
+}
+
+assembly_t* assemble_file(const char* path) {
+    if (strcmp(path, "-") == 0) {
+        return assemble(stdin, "<stdin>");
+    }
+
+    FILE* source = fopen(path, "rb");
+    if (source == NULL) {
+        LOG_ERROR("[-] Failed to open assembly source: " << path);
+        return NULL;
+    }
+
+    assembly_t* assembly = assemble(source, path);
+    fclose(source);
+    return assembly;
+}
+
+void free_assembly(assembly_t* assembly) {
+    if (assembly == NULL)
+        return;
+
+    free_program(assembly->program);
+    free_arena(assembly->arena);
+    free(assembly);
+}
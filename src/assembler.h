@@ -0,0 +1,49 @@
+#ifndef __ASSEMBLER_H__
+#define __ASSEMBLER_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "opcodes.h"
+#include "ilbuilder.h"
+#include "arena.h"
+#include "bytecode.h"
+
+// text front end, one instruction or label per line:
+//
+//   ; comments start with ';' or '#'
+//   start:                 a label names the instruction after it
+//       push 25            immediates: 25, -3, 0x19, 19h, 'a'
+//       pop r5             registers: r0..r8, pc, sp, px, zf, sf (a '%' prefix is fine)
+//       movi r1, 7
+//       add r1, r5
+//       addi r1, -2        register-immediate ALU: addi subi muli divi andi ori xori
+//       store r1, [r6 + 8] a word of guest memory, [reg], [reg + imm] or [reg - imm]
+//       load r2, [r6 + 8]
+//       cmp r1, r5         ZF = r1 == r5, SF = sign of r1 - r5
+//       jne start          jump operands (jmp, je, jne) are labels or raw byte offsets
+//       int 21h
+//
+// mnemonics and register names are case-insensitive, labels are not.
+//
+// it's a single pass over the source read through a fixed buffer, so the
+// text is never held in memory as a whole. instructions go straight into
+// the op_program_t. a jump to a label that isn't defined yet is parked on
+// that label and patched in place once the label shows up.
+static constexpr size_t ASSEMBLER_LINE_MAX = 64 * 1024;             // also the read buffer size
+static constexpr int ASSEMBLER_MAX_OPERANDS = 3;                     // encoded, a memory operand takes two
+
+typedef struct assembly_t {
+  op_program_t* program;
+  program_label_t* labels;                  // every label and the instruction it names
+  int label_count;
+  int lines;
+  arena_t* arena;                           // labels, their names and pending jumps
+};
+
+// 'name' is only used in error messages. returns NULL after logging the
+// first error (with its line number).
+assembly_t* assemble(FILE* source, const char* name);
+assembly_t* assemble_file(const char* path);                         // "-" reads stdin
+void free_assembly(assembly_t* assembly);
+
+#endif // __ASSEMBLER_H__
@@ -0,0 +1,170 @@
+#include "batch.h"
+#include "cpu.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct batch_queue_t {
+    std::mutex lock;
+    std::deque<int> jobs;
+};
+
+struct batch_context_t {
+    batch_job_t* jobs;
+    std::unordered_map<const op_program_t*, cpu_snapshot_t*>* images;
+    std::vector<batch_queue_t>* queues;
+    std::atomic<unsigned long long> steals;
+    std::atomic<unsigned long long> instructions;
+};
+
+// loads, decodes (and for the jit and aot engines, compiles) a program once through a
+// throwaway cpu and snapshots it. every job forks from that, so the loaded
+// image and the code are shared instead of rebuilt per job
+static cpu_snapshot_t* build_image(op_program_t* program, cpu_engine_t engine) {
+    auto cpu = (cpu_t*)malloc(sizeof(cpu_t));
+    if (cpu == NULL) {
+        LOG_ERROR("[-] Failed to allocate cpu_t for batch image");
+        return NULL;
+    }
+
+    cpu_snapshot_t* snapshot = NULL;
+    if (cpu->initialize(program)) {
+        cpu->engine = engine;
+        snapshot = cpu->snapshot();
+    }
+
+    cpu->release();
+    free(cpu);
+    return snapshot;
+}
+
+static bool next_job(batch_context_t* context, int worker, int* job) {
+    std::vector<batch_queue_t>& queues = *context->queues;
+
+    // own work first, newest end
+    {
+        std::lock_guard<std::mutex> guard(queues[worker].lock);
+        if (!queues[worker].jobs.empty()) {
+            (*job) = queues[worker].jobs.back();
+            queues[worker].jobs.pop_back();
+            return true;
+        }
+    }
+
+    // steal the oldest job of someone else. nothing is queued after the
+    // start, so one empty sweep means the batch is drained
+    const int count = (int)queues.size();
+    for (int i = 1; i < count; ++i) {
+        batch_queue_t& victim = queues[(worker + i) % count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty()) {
+            (*job) = victim.jobs.front();
+            victim.jobs.pop_front();
+            context->steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void batch_worker(batch_context_t* context, int worker) {
+    // one cpu per worker, forked again for every job
+    auto cpu = (cpu_t*)malloc(sizeof(cpu_t));
+    if (cpu == NULL) {
+        LOG_ERROR("[-] Failed to allocate cpu_t for batch worker " << worker);
+        return;
+    }
+
+    unsigned long long instructions = 0;
+    int idx;
+    while (next_job(context, worker, &idx)) {
+        batch_job_t* job = &context->jobs[idx];
+        if (!cpu->fork(context->images->at(job->program)))
+            continue;
+
+        for (int i = 0; i < BATCH_INPUT_REGISTERS; ++i) {
+            cpu->registers[i] = job->inputs[i];
+        }
+
+        cpu->execute();
+
+        memcpy(job->outputs, cpu->registers, sizeof(job->outputs));
+        job->cycles = cpu->info->total_run_cycles;
+        job->completed = true;
+        instructions += job->cycles;
+        cpu->release();
+    }
+
+    context->instructions.fetch_add(instructions, std::memory_order_relaxed);
+    free(cpu);
+}
+
+bool run_batch(batch_job_t* jobs, int count, cpu_engine_t engine, int threads, batch_stats_t* stats) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max(1, std::min(threads, count));
+
+    std::unordered_map<const op_program_t*, cpu_snapshot_t*> images;
+    for (int i = 0; i < count; ++i) {
+        jobs[i].completed = false;
+        if (images.count(jobs[i].program) != 0)
+            continue;
+
+        cpu_snapshot_t* image = build_image(jobs[i].program, engine);
+        if (image == NULL) {
+            LOG_ERROR("[-] Failed to build image for batch job " << i);
+            for (auto& entry : images) {
+                free_snapshot(entry.second);
+            }
+            return false;
+        }
+        images[jobs[i].program] = image;
+    }
+
+    // contiguous slices, so neighbouring jobs (often the same program) stay on one worker
+    std::vector<batch_queue_t> queues(threads);
+    for (int i = 0; i < count; ++i) {
+        queues[(long long)i * threads / count].jobs.push_back(i);
+    }
+
+    batch_context_t context;
+    context.jobs = jobs;
+    context.images = &images;
+    context.queues = &queues;
+    context.steals = 0;
+    context.instructions = 0;
+
+    // every job logs its own completion, only keep what needs attention
+    const int log_level = log_runtime_level;
+    log_runtime_level = LOG_LEVEL_WARN;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back(batch_worker, &context, i);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+    log_runtime_level = log_level;
+
+    for (auto& entry : images) {
+        free_snapshot(entry.second);
+    }
+
+    if (stats != NULL) {
+        stats->threads = threads;
+        stats->images = (int)images.size();
+        stats->steals = context.steals.load();
+        stats->instructions = context.instructions.load();
+        stats->seconds = std::chrono::duration<double>(end - start).count();
+    }
+    return true;
+}
\ No newline at end of file
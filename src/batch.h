@@ -0,0 +1,34 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "ilbuilder.h"
+#include "machine.h"
+
+static constexpr int BATCH_INPUT_REGISTERS = R8 + 1;         // R0..R8 can be seeded, the rest belong to the cpu
+
+typedef struct batch_job_t {
+  op_program_t* program;
+  unsigned int inputs[BATCH_INPUT_REGISTERS];
+  unsigned int outputs[REGISTER_SIZE];
+  unsigned int cycles;
+  bool completed;
+};
+
+typedef struct batch_stats_t {
+  int threads;
+  int images;                               // distinct programs, each decoded (and jit'd) once
+  unsigned long long steals;
+  unsigned long long instructions;
+  double seconds;
+};
+
+// runs every job on its own cpu_t over a pool of 'threads' workers (0 means
+// one per core). jobs start out spread across per-worker deques, a worker
+// that runs dry steals from the front of another worker's deque. jobs that
+// point at the same op_program_t fork from one snapshot of it, sharing its
+// loaded memory pages and decoded program.
+bool run_batch(batch_job_t* jobs, int count, cpu_engine_t engine, int threads, batch_stats_t* stats);
+
+#endif // __BATCH_H__
\ No newline at end of file
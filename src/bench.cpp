@@ -0,0 +1,559 @@
+//
+// Copyright (c) nexusverypro, 2025
+//
+
+#include "stdafx.h"
+#include "log.h"
+#include "ilbuilder.h"
+#include "optimizer.h"
+#include "cpu.h"
+#include "scheduler.h"
+#include "assembler.h"
+
+#include <chrono>
+#include <streambuf>
+#include <string>
+
+// getrusage() and fmemopen() are posix, elsewhere the peak rss isn't
+// reported and the assembler source goes through a tmpfile()
+#if defined(__unix__) || defined(__APPLE__)
+#define CEMU_HAS_POSIX 1
+#include <sys/resource.h>
+#else
+#define CEMU_HAS_POSIX 0
+#endif
+
+// cemu-bench: runs a fixed corpus of synthetic guest programs through one
+// engine and reports throughput. most programs are straight-line ("branches"
+// is a guest loop built on CMP; JE/JNE), so a "loop" is the program re-run
+// 'iterations' times from reset(), which keeps the loaded image and decoded/jit'd code.
+
+struct bench_options_t {
+    cpu_engine_t engine;
+    bool optimize;
+    bool json;
+    int iterations;
+    int size;                               // roughly how many instructions each program has
+    int quantum;                            // > 0 runs through run_for() slices of this many instructions
+    const char* workload;                   // NULL runs all of them
+};
+
+struct bench_result_t {
+    const char* name;
+    unsigned long long instructions;        // sum of cpu_info_t::total_run_cycles
+    double seconds;
+    bool skipped;                           // a cpu didn't load, nothing was run or timed
+};
+
+// swallows LOG_MSG output while timing, printing is not what we measure
+struct null_buffer_t : std::streambuf {
+    int overflow(int c) override { return c; }
+};
+
+// guest output goes through the cpu's host_io_t buffer as usual, and then here
+static FILE* guest_output = NULL;
+
+// the workloads loop until the program is long enough, so a program that
+// can't grow ends the whole run rather than spinning forever
+static void emit(op_program_t* program, op_type_t type, std::initializer_list<int> operands) {
+    if (!append_instruction(program, type, (int)operands.size(), operands.begin(), operands.size() * sizeof(int))) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int byte_offset(const op_program_t* program) {
+    return program->length * (int)(sizeof(unsigned char) + sizeof(int)) + (int)program->operands_length;
+}
+
+#pragma region Workloads
+
+static op_program_t* build_arithmetic(int size) {
+    auto program = create_program();
+    emit(program, PUSH, { 3 }); emit(program, POP, { R1 });
+    emit(program, PUSH, { 7 }); emit(program, POP, { R2 });
+
+    while (program->length < size) {
+        emit(program, ADD, { R0, R1 });
+        emit(program, MUL, { R0, R2 });
+        emit(program, SUB, { R0, R1 });
+        emit(program, XOR, { R3, R0 });
+        emit(program, OR,  { R4, R3 });
+        emit(program, DIV, { R0, R2 });
+    }
+    return program;
+}
+
+// the same kind of churn through LOAD/STORE on a scratch area near the top
+// of the default 64 KB guest memory, well above the stack and the program image
+static op_program_t* build_memory(int size) {
+    auto program = create_program();
+    emit(program, PUSH, { 0xFF00 }); emit(program, POP, { R5 });
+
+    while (program->length < size) {
+        emit(program, ADDI,  { R0, 3 });
+        emit(program, STORE, { R0, R5, 0 });
+        emit(program, LOAD,  { R2, R5, 0 });
+        emit(program, XORI,  { R2, 0x55 });
+        emit(program, STORE, { R2, R5, 4 });
+        emit(program, LOAD,  { R3, R5, 4 });
+        emit(program, ANDI,  { R3, 0xFF });
+        emit(program, ADD,   { R4, R3 });
+    }
+    return program;
+}
+
+static op_program_t* build_stack_churn(int size) {
+    auto program = create_program();
+    for (int i = 0; program->length < size; ++i) {
+        emit(program, PUSH, { i });
+        emit(program, PUSH, { i + 1 });
+        emit(program, POP, { R0 });
+        emit(program, POP, { R1 });
+        emit(program, ADD, { R0, R1 });
+    }
+    return program;
+}
+
+static op_program_t* build_jumps(int size) {
+    auto program = create_program();
+    while (program->length < size) {
+        // JMP over a PUSH that never runs, landing on an ADD so the
+        // optimizer has no JMP -> JMP chain to thread
+        const int target = byte_offset(program) + 2 * (int)(sizeof(unsigned char) + sizeof(int) + sizeof(int));
+        emit(program, JMP, { target });
+        emit(program, PUSH, { 0 });
+        emit(program, ADD, { R0, R1 });
+    }
+    return program;
+}
+
+// a counted loop with a data-dependent branch inside, CMP; JNE at the bottom.
+// runs about 'size' instructions, the optimizer fuses both compares
+static op_program_t* build_branches(int size) {
+    auto program = create_program();
+    emit(program, PUSH, { size / 8 }); emit(program, POP, { R1 });
+    emit(program, PUSH, { 0 }); emit(program, POP, { R8 });
+
+    const int loop = byte_offset(program);
+    emit(program, ADDI, { R0, 7 });
+    emit(program, ANDI, { R0, 0xFF });
+    emit(program, CMP,  { R0, R8 });
+    // JE over the XORI, landing on the SUBI
+    const int skip = byte_offset(program) + (int)(sizeof(unsigned char) + sizeof(int) * 2) +
+                     (int)(sizeof(unsigned char) + sizeof(int) * 3);
+    emit(program, JE,   { skip });
+    emit(program, XORI, { R2, 0x55 });
+    emit(program, SUBI, { R1, 1 });
+    emit(program, CMP,  { R1, R8 });
+    emit(program, JNE,  { loop });
+    return program;
+}
+
+// a loop that never ends, JMP back to the start. only runnable with a budget
+static op_program_t* build_spin(int size) {
+    auto program = create_program();
+    while (program->length < size - 1) {
+        emit(program, ADD, { R0, R1 });
+        emit(program, XOR, { R2, R0 });
+    }
+    emit(program, JMP, { 0 });
+    return program;
+}
+
+// a byte at a time through the putc service, what the output buffering is for
+static op_program_t* build_interrupts(int size) {
+    auto program = create_program();
+    emit(program, PUSH, { '.' });
+    emit(program, POP, { R0 });
+    while (program->length < size) {
+        emit(program, INT, { INTERRUPT_PUTC });
+        emit(program, ADD, { R0, R1 });
+    }
+    return program;
+}
+
+#pragma endregion
+
+// high-water mark of the whole process, every workload only ever adds to
+// it, so it's reported once for the run. -1 where it can't be read
+static long peak_rss_kb() {
+#if CEMU_HAS_POSIX
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;          // bytes there, kilobytes on linux
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+static bench_result_t skipped_result(const char* name, const char* reason = "program did not load") {
+    fprintf(stderr, "[-] %s: %s, skipped\n", name, reason);
+    return { name, 0, 0, true };
+}
+
+static bench_result_t run_program(const char* name, op_program_t* program, const bench_options_t* options) {
+    if (options->optimize) {
+        optimize_report_t report;
+        auto optimized = optimize_program(program, &report);
+        if (optimized != NULL) {
+            free_program(program);
+            program = optimized;
+        }
+    }
+
+    auto cpu = (cpu_t*)malloc(sizeof(cpu_t));
+    if (!cpu->initialize(program)) {
+        cpu->release();
+        free(cpu);
+        free_program(program);
+        return skipped_result(name);
+    }
+    cpu->engine = options->engine;
+    cpu->io.out = guest_output;
+
+    // first run warms up decoding / jit compilation and isn't timed
+    cpu->execute();
+
+    unsigned long long instructions = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options->iterations; ++i) {
+        cpu->reset();
+        cpu->info->total_run_cycles = 0;
+        if (options->quantum > 0) {
+            while (cpu->run_for(options->quantum) == CPU_YIELDED) {}
+        } else {
+            cpu->execute();
+        }
+        instructions += cpu->info->total_run_cycles;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    cpu->release();
+    free(cpu);
+    free_program(program);
+
+    return { name, instructions, std::chrono::duration<double>(end - start).count(), false };
+}
+
+// a fresh cpu per run, forked from a snapshot of the loaded program instead
+// of initialize(). the time includes fork() and release(), per instruction run.
+static bench_result_t run_forks(const char* name, op_program_t* program, const bench_options_t* options) {
+    if (options->optimize) {
+        optimize_report_t report;
+        auto optimized = optimize_program(program, &report);
+        if (optimized != NULL) {
+            free_program(program);
+            program = optimized;
+        }
+    }
+
+    auto source = (cpu_t*)malloc(sizeof(cpu_t));
+    cpu_snapshot_t* snapshot = NULL;
+    if (source->initialize(program)) {
+        source->engine = options->engine;
+        snapshot = source->snapshot();
+    }
+    if (snapshot == NULL) {
+        source->release();
+        free(source);
+        free_program(program);
+        return skipped_result(name);
+    }
+
+    auto cpu = (cpu_t*)malloc(sizeof(cpu_t));
+    unsigned long long instructions = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options->iterations; ++i) {
+        if (!cpu->fork(snapshot))
+            break;
+
+        cpu->execute();
+        instructions += cpu->info->total_run_cycles;
+        cpu->release();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    free(cpu);
+    source->release();
+    free(source);
+    free_snapshot(snapshot);
+    free_program(program);
+
+    return { name, instructions, std::chrono::duration<double>(end - start).count(), false };
+}
+
+// there is no guest instruction that allocates, so this one drives
+// asm_malloc()/asm_mfree() from the host. an "instruction" is one call.
+static bench_result_t run_allocation_churn(const bench_options_t* options) {
+    auto program = create_program();
+    auto cpu = (cpu_t*)malloc(sizeof(cpu_t));
+    if (!cpu->initialize(program)) {
+        cpu->release();
+        free(cpu);
+        free_program(program);
+        return skipped_result("alloc");
+    }
+
+    static constexpr int LIVE_BLOCKS = 64;
+    void* blocks[LIVE_BLOCKS] = {};
+    unsigned long long calls = 0;
+    unsigned int seed = 12345;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options->iterations; ++i) {
+        for (int j = 0; j < options->size; ++j) {
+            seed = seed * 1103515245 + 12345;
+            const int slot = (seed >> 16) % LIVE_BLOCKS;
+            if (blocks[slot] != NULL) {
+                cpu->asm_mfree(blocks[slot]);
+                blocks[slot] = NULL;
+            } else {
+                blocks[slot] = cpu->asm_malloc(16 + (seed >> 8) % 240);
+            }
+            calls++;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    cpu->release();
+    free(cpu);
+    free_program(program);
+
+    return { "alloc", calls, std::chrono::duration<double>(end - start).count(), false };
+}
+
+// many guests that never halt, interleaved on this thread by scheduler_t.
+// every round gives each of them one slice, 'iterations' rounds are timed.
+static bench_result_t run_tenants(const bench_options_t* options) {
+    static constexpr int TENANTS = 16;
+    const unsigned int quantum = options->quantum > 0 ? options->quantum : SCHEDULER_DEFAULT_QUANTUM;
+
+    auto program = build_spin(options->size / TENANTS);
+    if (options->optimize) {
+        optimize_report_t report;
+        auto optimized = optimize_program(program, &report);
+        if (optimized != NULL) {
+            free_program(program);
+            program = optimized;
+        }
+    }
+
+    auto scheduler = create_scheduler(quantum);
+    cpu_t* cpus[TENANTS];
+    int loaded = 0;
+    for (; loaded < TENANTS; ++loaded) {
+        cpus[loaded] = (cpu_t*)malloc(sizeof(cpu_t));
+        if (!cpus[loaded]->initialize(program)) {
+            cpus[loaded]->release();
+            free(cpus[loaded]);
+            break;
+        }
+        cpus[loaded]->engine = options->engine;
+        cpus[loaded]->registers[R1] = loaded + 1;
+        scheduler->add(cpus[loaded]);
+    }
+    if (loaded < TENANTS) {
+        for (int i = 0; i < loaded; ++i) {
+            cpus[i]->release();
+            free(cpus[i]);
+        }
+        free_scheduler(scheduler);
+        free_program(program);
+        return skipped_result("tenants");
+    }
+
+    // first round warms up decoding / jit compilation and isn't timed
+    for (int i = 0; i < TENANTS; ++i) {
+        scheduler->step();
+    }
+
+    unsigned long long instructions = 0;
+    for (int i = 0; i < TENANTS; ++i) {
+        instructions -= cpus[i]->info->total_run_cycles;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options->iterations * TENANTS; ++i) {
+        scheduler->step();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < TENANTS; ++i) {
+        instructions += cpus[i]->info->total_run_cycles;
+        cpus[i]->release();
+        free(cpus[i]);
+    }
+    free_scheduler(scheduler);
+    free_program(program);
+
+    return { "tenants", instructions, std::chrono::duration<double>(end - start).count(), false };
+}
+
+// the text front end, not the cpu: 'size' lines of generated source with a
+// label every few lines and forward jumps to it, assembled 'iterations' times
+// from memory. an "instruction" is one assembled instruction.
+static bench_result_t run_assembler(const bench_options_t* options) {
+    std::string source;
+    for (int i = 0; i < options->size; ++i) {
+        char line[64];
+        switch (i % 4) {
+            case 0: snprintf(line, sizeof(line), "l%d:\n    push %d\n", i, i); break;
+            case 1: snprintf(line, sizeof(line), "    pop r%d             ; comment\n", i % 9); break;
+            case 2: snprintf(line, sizeof(line), "    jmp l%d\n", i + 2); break;
+            case 3: snprintf(line, sizeof(line), "    movi r1, 0x%x\n", i); break;
+        }
+        source += line;
+    }
+    source += "l" + std::to_string((options->size + 3) / 4 * 4) + ":\n";
+
+#if !CEMU_HAS_POSIX
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        return skipped_result("asm", "no temporary file for the source");
+    }
+    fwrite(source.data(), 1, source.size(), file);
+#endif
+
+    unsigned long long instructions = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options->iterations; ++i) {
+#if CEMU_HAS_POSIX
+        FILE* file = fmemopen(source.data(), source.size(), "r");
+#else
+        rewind(file);
+#endif
+        assembly_t* assembly = assemble(file, "bench");
+        instructions += assembly != NULL ? assembly->program->length : 0;
+        free_assembly(assembly);
+#if CEMU_HAS_POSIX
+        fclose(file);
+#endif
+    }
+    auto end = std::chrono::steady_clock::now();
+#if !CEMU_HAS_POSIX
+    fclose(file);
+#endif
+
+    return { "asm", instructions, std::chrono::duration<double>(end - start).count(), false };
+}
+
+static bool parse_int_option(const char* arg, const char* prefix, int* out) {
+    const size_t length = strlen(prefix);
+    if (strncmp(arg, prefix, length) != 0)
+        return false;
+
+    (*out) = std::max(1, atoi(arg + length));
+    return true;
+}
+
+// --engine=switch|threaded|jit|inplace|aot|block
+// --iterations=N         re-runs of every program (default 200)
+// --size=N               instructions per program (default 4000, the image has to fit in guest memory)
+// --workload=NAME        arith, stack, memory, alloc, jumps, branches, interrupts, tenants,
+//                        fork or asm
+// --quantum=N            run in run_for() slices of N instructions (tenants defaults to 10000)
+// --no-optimize          skip optimize_program()
+// --json                 one json document on stdout instead of a table
+static bench_options_t parse_options(int argc, char* argv[]) {
+    bench_options_t options = { ENGINE_SWITCH, true, false, 200, 4000, 0, NULL };
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--engine=", 9) == 0) {
+            if (!parse_engine_name(argv[i] + 9, &options.engine)) {
+                LOG_WARN("[!] Unknown engine: " << argv[i] + 9);
+            }
+        } else if (strncmp(argv[i], "--workload=", 11) == 0) {
+            options.workload = argv[i] + 11;
+        } else if (parse_int_option(argv[i], "--iterations=", &options.iterations) ||
+                   parse_int_option(argv[i], "--size=", &options.size) ||
+                   parse_int_option(argv[i], "--quantum=", &options.quantum)) {
+            continue;
+        } else if (strcmp(argv[i], "--no-optimize") == 0) {
+            options.optimize = false;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            options.json = true;
+        } else {
+            LOG_WARN("[!] Unknown argument: " << argv[i]);
+        }
+    }
+    return options;
+}
+
+static bool wants(const bench_options_t* options, const char* name) {
+    return options->workload == NULL || strcmp(options->workload, name) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    const bench_options_t options = parse_options(argc, argv);
+
+    bench_result_t results[11];
+    int count = 0;
+
+    null_buffer_t null_buffer;
+    std::streambuf* stdout_buffer = std::cout.rdbuf(&null_buffer);
+#if defined(_WIN32)
+    guest_output = fopen("NUL", "wb");
+#else
+    guest_output = fopen("/dev/null", "wb");
+#endif
+    {
+        if (wants(&options, "arith"))      results[count++] = run_program("arith", build_arithmetic(options.size), &options);
+        if (wants(&options, "stack"))      results[count++] = run_program("stack", build_stack_churn(options.size), &options);
+        if (wants(&options, "memory"))     results[count++] = run_program("memory", build_memory(options.size), &options);
+        if (wants(&options, "alloc"))      results[count++] = run_allocation_churn(&options);
+        if (wants(&options, "jumps"))      results[count++] = run_program("jumps", build_jumps(options.size), &options);
+        if (wants(&options, "branches"))   results[count++] = run_program("branches", build_branches(options.size), &options);
+        if (wants(&options, "interrupts")) results[count++] = run_program("interrupts", build_interrupts(options.size), &options);
+        if (wants(&options, "tenants"))    results[count++] = run_tenants(&options);
+        if (wants(&options, "fork"))       results[count++] = run_forks("fork", build_stack_churn(options.size / 10), &options);
+        if (wants(&options, "asm"))        results[count++] = run_assembler(&options);
+    }
+    std::cout.rdbuf(stdout_buffer);
+    if (guest_output != NULL) {
+        fclose(guest_output);
+    }
+
+    if (options.json) {
+        printf("{\"engine\":\"%s\",\"optimize\":%s,\"iterations\":%d,\"size\":%d,\"results\":[",
+               engine_name(options.engine), options.optimize ? "true" : "false", options.iterations, options.size);
+    } else {
+        printf("engine: %s, optimize: %s, iterations: %d, size: %d\n",
+               engine_name(options.engine), options.optimize ? "on" : "off", options.iterations, options.size);
+        printf("%-12s %14s %12s %14s %10s\n", "workload", "instructions", "seconds", "inst/s", "ns/inst");
+    }
+
+    for (int i = 0; i < count; ++i) {
+        const bench_result_t* result = &results[i];
+        if (result->skipped) {
+            if (options.json) {
+                printf("%s{\"workload\":\"%s\",\"skipped\":true}", i == 0 ? "" : ",", result->name);
+            } else {
+                printf("%-12s %14s\n", result->name, "skipped");
+            }
+            continue;
+        }
+
+        const double ips = result->seconds > 0 ? result->instructions / result->seconds : 0;
+        const double ns = result->instructions > 0 ? result->seconds * 1e9 / result->instructions : 0;
+
+        if (options.json) {
+            printf("%s{\"workload\":\"%s\",\"instructions\":%llu,\"seconds\":%.6f,\"instructions_per_second\":%.0f,"
+                   "\"ns_per_instruction\":%.3f}",
+                   i == 0 ? "" : ",", result->name, result->instructions, result->seconds, ips, ns);
+        } else {
+            printf("%-12s %14llu %12.6f %14.0f %10.3f\n",
+                   result->name, result->instructions, result->seconds, ips, ns);
+        }
+    }
+
+    const long rss = peak_rss_kb();
+    if (options.json) {
+        printf("],\"peak_rss_kb\":%ld}\n", rss);
+    } else if (rss >= 0) {
+        printf("peak rss: %ld kb (whole process, every workload above)\n", rss);
+    }
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
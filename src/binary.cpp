@@ -1,37 +1,57 @@
 #include "binary.h"
 
 bool binaryc_t::is_out_of_bounds(size_t move_size) {
-    return this->position + move_size > MAX_BINARY_COMMON_SIZE;
+    return this->position + move_size > this->length;
+}
+
+bool binaryc_t::reserve(size_t capacity) {
+    if (capacity <= this->capacity) {
+        return true;
+    }
+
+    if (!this->owns_memory) {
+        return false;
+    }
+
+    size_t new_capacity = std::max(this->capacity, BINARY_INITIAL_CAPACITY);
+    while (new_capacity < capacity) {
+        new_capacity *= 2;
+    }
+
+    unsigned char* new_memory = (unsigned char*)realloc(this->memory, new_capacity);
+    if (new_memory == NULL) {
+        LOG_ERROR("[-] Failed to grow binary stream to " << new_capacity << " bytes");
+        return false;
+    }
+
+    this->memory = new_memory;
+    this->capacity = new_capacity;
+    return true;
 }
 
 size_t binaryc_t::append(const unsigned char* data, size_t length) {
     if (!this->can_write) {
-      LOG_MSG("[-] Cannot append() because the stream is not writable");
+      LOG_ERROR("[-] Cannot append() because the stream is not writable");
       return 0;
     }
 
-    if (is_out_of_bounds(length)) {
-      LOG_MSG("[-] append() is out of bounds (position: " << this->position << ", move size: " << this->position + length << ", max: " << MAX_BINARY_COMMON_SIZE << ")");
+    if (!reserve(position + length)) {
+      LOG_ERROR("[-] append() is out of bounds (position: " << this->position << ", move size: " << this->position + length << ", max: " << this->capacity << ")");
       return 0;
     }
 
     memcpy(&memory[position], data, length);
     position += length;
-    this->length += length;
+    this->length = std::max(this->length, position);
 
     return length;
   }
 
 size_t binaryc_t::read(unsigned char* dest, size_t length) {
-    if (length < 0) {
-        LOG_MSG("[-] read() received a negative length");
-        return 0;
-    }
-
     if (is_out_of_bounds(length)) {
-        LOG_MSG("[-] read() is out of bounds (position: " << position 
+        LOG_ERROR("[-] read() is out of bounds (position: " << position 
                 << ", move size: " << position + length 
-                << ", max: " << MAX_BINARY_COMMON_SIZE << ")");
+                << ", max: " << this->length << ")");
         return 0;
     }
 
@@ -42,11 +62,10 @@ size_t binaryc_t::read(unsigned char* dest, size_t length) {
 
 void binaryc_t::reset() { this->position = 0; }
 
-// Returns a dangling pointer. Remember to free after use.
+// Returns a view of the stream's bytes, only valid until the next append()
+// or free_binary_stream(). Do not free.
 const unsigned char* binaryc_t::get() { 
-    unsigned char* ptr = (unsigned char*)malloc(sizeof(unsigned char) * this->length);
-    memcpy(ptr, this->memory, this->length);
-    return ptr;
+    return this->memory;
 }
 
 void binaryp_t::write_int8(char i) {
@@ -141,15 +160,69 @@ size_t binaryp_t::read_string(unsigned char* buffer) {
     return this->read(buffer, length);
 }
 
-binaryp_t* create_binary_stream(bool can_write) {
+static binaryp_t* allocate_binary_stream() {
     binaryp_t* stream = (binaryp_t*)malloc(sizeof(binaryp_t));
     if (stream == nullptr) {
-        LOG_MSG("[-] Failed to allocate memory for binaryc_t stream");
+        LOG_ERROR("[-] Failed to allocate memory for binaryc_t stream");
         return NULL;
     }
 
     stream->position = 0;
+    stream->length = 0;
+    stream->capacity = 0;
+    stream->can_write = false;
+    stream->owns_memory = false;
+    stream->memory = NULL;
+    return stream;
+}
+
+binaryp_t* create_binary_stream(bool can_write) {
+    binaryp_t* stream = allocate_binary_stream();
+    if (stream == NULL) {
+        return NULL;
+    }
+
     stream->can_write = can_write;
-    memset(stream->memory, 0, sizeof(stream->memory));
+    stream->owns_memory = true;
+    if (!stream->reserve(BINARY_INITIAL_CAPACITY)) {
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+binaryp_t* create_binary_view(const unsigned char* data, size_t length) {
+    binaryp_t* stream = allocate_binary_stream();
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    // never written through, can_write is false
+    stream->memory = const_cast<unsigned char*>(data);
+    stream->length = length;
+    stream->capacity = length;
+    return stream;
+}
+
+binaryp_t* create_binary_span(unsigned char* data, size_t capacity) {
+    binaryp_t* stream = allocate_binary_stream();
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    stream->memory = data;
+    stream->capacity = capacity;
+    stream->can_write = true;
     return stream;
+}
+
+void free_binary_stream(binaryp_t* stream) {
+    if (stream == NULL) {
+        return;
+    }
+
+    if (stream->owns_memory) {
+        free(stream->memory);
+    }
+    free(stream);
 }
\ No newline at end of file
@@ -4,15 +4,21 @@
 #include "stdafx.h"
 #include "log.h"
 
-static constexpr int MAX_BINARY_COMMON_SIZE = 12 * 8 * 8 * 4 * 2;
+static constexpr size_t BINARY_INITIAL_CAPACITY = 256;
 
+// either owns a buffer that grows geometrically on append(), or borrows
+// someone else's memory (see create_binary_view / create_binary_span) and
+// never copies or frees it.
 typedef struct binaryc_t {
   size_t position;
   size_t length;
+  size_t capacity;
   bool can_write;
-  unsigned char memory[MAX_BINARY_COMMON_SIZE];
+  bool owns_memory;
+  unsigned char* memory;
 
   bool is_out_of_bounds(size_t move_size);
+  bool reserve(size_t capacity);
   size_t append(const unsigned char* data, size_t length);
   size_t read(unsigned char* dest, size_t length);
   void reset();
@@ -43,5 +49,8 @@ typedef struct binaryp_t : public binaryc_t {
 };
 
 binaryp_t* create_binary_stream(bool can_write);
+binaryp_t* create_binary_view(const unsigned char* data, size_t length);       // read-only, borrows 'data'
+binaryp_t* create_binary_span(unsigned char* data, size_t capacity);           // writes into 'data', never grows
+void free_binary_stream(binaryp_t* stream);
 
 #endif // __BINARY_H__
\ No newline at end of file
@@ -0,0 +1,304 @@
+#include "bytecode.h"
+#include "binary.h"
+#include "pages.h"
+#include "verifier.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CEMU_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define CEMU_HAS_MMAP 0
+#endif
+
+static constexpr int BYTECODE_SECTIONS = 4;
+
+#pragma region Writer
+
+// writes 'size' bytes and zero-pads them up to 'padded'
+static bool write_padded(FILE* file, const void* data, size_t size, size_t padded) {
+    static const unsigned char zeroes[MEMORY_PAGE_SIZE] = {};
+    if (size > 0 && fwrite(data, 1, size, file) != size)
+        return false;
+
+    for (size_t left = padded - size; left > 0;) {
+        const size_t chunk = std::min(left, sizeof(zeroes));
+        if (fwrite(zeroes, 1, chunk, file) != chunk)
+            return false;
+        left -= chunk;
+    }
+    return true;
+}
+
+bool write_bytecode_file(const char* path, const op_program_t* program, const program_label_t* labels, int label_count) {
+    // the same bytes cpu_t::initialize_bytecode() lays down in guest memory
+    binaryp_t* code = create_binary_stream(true);
+    binaryp_t* constants = create_binary_stream(true);
+    if (code == NULL || constants == NULL) {
+        free_binary_stream(code);
+        free_binary_stream(constants);
+        return false;
+    }
+
+    for (int i = 0; i < program->length; ++i) {
+        code->write_uint8(program->types[i]);
+        code->write_int32(program->lengths[i]);
+        code->append(program->operands_of(i), program->operands_size(i));
+    }
+
+    op_decoded_program_t* decoded = decode_bytecode(code->get(), code->length);
+    bytecode_label_t* file_labels = (bytecode_label_t*)malloc(sizeof(bytecode_label_t) * (label_count + 1));
+    if (decoded == NULL || file_labels == NULL) {
+        LOG_ERROR("[-] Failed to prepare bytecode file: " << path);
+        free_decoded_program(decoded);
+        free(file_labels);
+        free_binary_stream(code);
+        free_binary_stream(constants);
+        return false;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < label_count; ++i) {
+        if (labels[i].index < 0 || labels[i].index > decoded->length) {
+            LOG_WARN("[!] Label '" << labels[i].name << "' points outside the program, dropped");
+            continue;
+        }
+
+        file_labels[kept].name = (unsigned int)constants->length;
+        file_labels[kept].index = labels[i].index;
+        file_labels[kept].offset = (unsigned int)decoded->instructions[labels[i].index].offset;
+        constants->append((const unsigned char*)labels[i].name, strlen(labels[i].name) + 1);
+        kept++;
+    }
+
+    bytecode_header_t header = {};
+    header.magic = BYTECODE_MAGIC;
+    header.version = BYTECODE_VERSION;
+    header.section_count = BYTECODE_SECTIONS;
+    header.decoded_size = sizeof(op_decoded_t);
+    header.instruction_count = (unsigned int)decoded->length;
+
+    const void* contents[BYTECODE_SECTIONS] = { code->get(), decoded->instructions, file_labels, constants->get() };
+    bytecode_section_t sections[BYTECODE_SECTIONS] = {
+        { SECTION_BYTECODE, (unsigned int)decoded->length, 0, code->length },
+        { SECTION_DECODED, (unsigned int)decoded->length, 0, sizeof(op_decoded_t) * (decoded->length + 1) },
+        { SECTION_LABELS, (unsigned int)kept, 0, sizeof(bytecode_label_t) * kept },
+        { SECTION_CONSTANTS, (unsigned int)constants->length, 0, constants->length },
+    };
+
+    size_t offset = page_align(sizeof(header) + sizeof(sections));
+    for (int i = 0; i < BYTECODE_SECTIONS; ++i) {
+        sections[i].offset = offset;
+        offset += page_align(sections[i].size);
+    }
+    header.file_size = offset;
+
+    FILE* file = fopen(path, "wb");
+    bool ok = file != NULL;
+    if (ok) {
+        ok = write_padded(file, &header, sizeof(header), sizeof(header)) &&
+             write_padded(file, sections, sizeof(sections), page_align(sizeof(header) + sizeof(sections)) - sizeof(header));
+        for (int i = 0; ok && i < BYTECODE_SECTIONS; ++i) {
+            ok = write_padded(file, contents[i], sections[i].size, page_align(sections[i].size));
+        }
+        ok = fclose(file) == 0 && ok;
+    }
+
+    if (ok) {
+        LOG_MSG("[+] Wrote " << decoded->length << " instructions, " << kept << " labels to " << path << " (" << offset << " bytes)");
+    } else {
+        LOG_ERROR("[-] Failed to write bytecode file: " << path);
+    }
+
+    free_decoded_program(decoded);
+    free(file_labels);
+    free_binary_stream(code);
+    free_binary_stream(constants);
+    return ok;
+}
+
+#pragma endregion
+
+#pragma region Loader
+
+// the only pass over the file: header and section bounds, plus every
+// next/target index, since the engines follow those without checking
+static bool validate_bytecode_file(bytecode_file_t* file) {
+    if (file->size < sizeof(bytecode_header_t))
+        return false;
+
+    const bytecode_header_t* header = (const bytecode_header_t*)file->data;
+    if (header->magic != BYTECODE_MAGIC || header->version != BYTECODE_VERSION ||
+        header->decoded_size != sizeof(op_decoded_t) || header->file_size > file->size ||
+        header->section_count > BYTECODE_MAX_SECTIONS ||
+        sizeof(bytecode_header_t) + sizeof(bytecode_section_t) * header->section_count > file->size) {
+        return false;
+    }
+
+    const int length = (int)header->instruction_count;
+    const bytecode_section_t* sections = (const bytecode_section_t*)(file->data + sizeof(bytecode_header_t));
+    bool has_bytecode = false;
+    bool has_decoded = false;
+
+    for (int i = 0; i < header->section_count; ++i) {
+        const bytecode_section_t* section = &sections[i];
+        if (section->offset % MEMORY_PAGE_SIZE != 0 || section->offset > file->size ||
+            page_align(section->size) > file->size - section->offset) {
+            return false;
+        }
+
+        const unsigned char* data = file->data + section->offset;
+        switch (section->kind) {
+            case SECTION_BYTECODE: {
+                file->bytecode = data;
+                file->bytecode_offset = section->offset;
+                file->bytecode_length = section->size;
+                has_bytecode = true;
+                break;
+            }
+            case SECTION_DECODED: {
+                if (section->size != sizeof(op_decoded_t) * ((size_t)length + 1))
+                    return false;
+
+                file->decoded.length = length;
+                file->decoded.instructions = (op_decoded_t*)data;
+                has_decoded = true;
+                break;
+            }
+            case SECTION_LABELS: {
+                if (section->size != sizeof(bytecode_label_t) * section->count)
+                    return false;
+
+                file->labels = (const bytecode_label_t*)data;
+                file->label_count = (int)section->count;
+                break;
+            }
+            case SECTION_CONSTANTS: {
+                file->constants = (const char*)data;
+                file->constants_size = section->size;
+                break;
+            }
+            default: {
+                break;                      // newer optional sections are skipped
+            }
+        }
+    }
+
+    if (!has_bytecode || !has_decoded)
+        return false;
+
+    file->decoded.bytecode_length = file->bytecode_length;
+    for (int i = 0; i < length; ++i) {
+        const op_decoded_t* inst = &file->decoded.instructions[i];
+        if (inst->next < 0 || inst->next > length || inst->target < -1 || inst->target > length ||
+            inst->offset < 0 || (size_t)inst->offset >= file->bytecode_length) {
+            return false;
+        }
+    }
+    return (size_t)file->decoded.instructions[length].offset == file->bytecode_length;
+}
+
+bytecode_file_t* load_bytecode_file(const char* path) {
+    bytecode_file_t* file = (bytecode_file_t*)calloc(1, sizeof(bytecode_file_t));
+    if (file == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for bytecode_file_t");
+        return NULL;
+    }
+    file->fd = -1;
+
+#if CEMU_HAS_MMAP
+    file->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file->fd < 0 || fstat(file->fd, &st) != 0 || st.st_size <= 0) {
+        LOG_ERROR("[-] Failed to open bytecode file: " << path);
+        free_bytecode_file(file);
+        return NULL;
+    }
+
+    file->size = (size_t)st.st_size;
+    void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+    if (data == MAP_FAILED) {
+        LOG_ERROR("[-] Failed to map bytecode file: " << path);
+        file->size = 0;
+        free_bytecode_file(file);
+        return NULL;
+    }
+    file->data = (unsigned char*)data;
+#else
+    FILE* stream = fopen(path, "rb");
+    if (stream == NULL) {
+        LOG_ERROR("[-] Failed to open bytecode file: " << path);
+        free_bytecode_file(file);
+        return NULL;
+    }
+
+    fseek(stream, 0, SEEK_END);
+    file->size = (size_t)std::max(0L, ftell(stream));
+    fseek(stream, 0, SEEK_SET);
+    file->data = (unsigned char*)malloc(std::max<size_t>(file->size, 1));
+    if (file->data == NULL || fread(file->data, 1, file->size, stream) != file->size) {
+        LOG_ERROR("[-] Failed to read bytecode file: " << path);
+        fclose(stream);
+        free_bytecode_file(file);
+        return NULL;
+    }
+    fclose(stream);
+#endif
+
+    if (!validate_bytecode_file(file)) {
+        LOG_ERROR("[-] Not a valid bytecode file: " << path);
+        free_bytecode_file(file);
+        return NULL;
+    }
+
+    // the decoded section is trusted as far as validate_bytecode_file() looked,
+    // it's verified like any freshly decoded program before it runs unchecked
+    verify_report_t report;
+    if (!verify_program(&file->decoded, &report)) {
+        LOG_DEBUG("[D] Bytecode file not verified, instruction " << report.failed_at << ": " << report.reason);
+    }
+    build_blocks(&file->decoded);
+
+    LOG_MSG("[+] Loaded " << file->decoded.length << " instructions, " << file->label_count << " labels from " << path);
+    return file;
+}
+
+void free_bytecode_file(bytecode_file_t* file) {
+    if (file == NULL)
+        return;
+
+#if CEMU_HAS_MMAP
+    if (file->data != NULL) {
+        munmap(file->data, file->size);
+    }
+    if (file->fd >= 0) {
+        close(file->fd);
+    }
+#else
+    free(file->data);
+#endif
+    free(file->decoded.stack_depths);
+    free_blocks(&file->decoded);
+    free(file);
+}
+
+const char* bytecode_file_t::label_name(int idx) const {
+    if (idx < 0 || idx >= label_count || labels[idx].name >= constants_size)
+        return "";
+
+    // names are nul-terminated by the writer, a broken pool just ends at its last byte
+    const char* name = constants + labels[idx].name;
+    return memchr(name, 0, constants_size - labels[idx].name) != NULL ? name : "";
+}
+
+int bytecode_file_t::find_label(const char* name) const {
+    for (int i = 0; i < label_count; ++i) {
+        if (strcmp(label_name(i), name) == 0)
+            return labels[i].index;
+    }
+    return -1;
+}
+
+#pragma endregion
\ No newline at end of file
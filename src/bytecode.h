@@ -0,0 +1,84 @@
+#ifndef __BYTECODE_H__
+#define __BYTECODE_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "ilbuilder.h"
+#include "decoder.h"
+
+// on-disk program, laid out so a loader can mmap it and run it as is:
+//
+//   header | section table | bytecode | decoded | labels | constants
+//
+// every section starts on a page boundary. 'bytecode' is exactly what
+// cpu_t::initialize_bytecode() writes into guest memory (padded to a whole
+// page), so it can be mapped straight into a cpu. 'decoded' is the
+// op_decoded_t array with jump targets already resolved, so nothing gets
+// decoded either. 'labels' name instruction indices, their names sit in the
+// 'constants' pool as nul-terminated strings.
+//
+// 'decoded' is the in-memory layout of op_decoded_t, the header records its
+// size and the loader refuses files written with a different one.
+static constexpr unsigned int BYTECODE_MAGIC = 0x43424543;            // "CEBC"
+static constexpr unsigned short BYTECODE_VERSION = 2;                // 2: branch targets and eager_flags in 'decoded'
+static constexpr int BYTECODE_MAX_SECTIONS = 8;
+
+enum bytecode_section_kind_t : unsigned int {
+    SECTION_BYTECODE    = 0x01,             // guest bytecode, count = instructions
+    SECTION_DECODED     = 0x02,             // op_decoded_t[count + 1], the last one is the end sentinel
+    SECTION_LABELS      = 0x03,             // bytecode_label_t[count]
+    SECTION_CONSTANTS   = 0x04,             // constant pool, count = bytes used
+};
+
+typedef struct bytecode_header_t {
+  unsigned int magic;
+  unsigned short version;
+  unsigned short section_count;
+  unsigned int decoded_size;                // sizeof(op_decoded_t) of the writer
+  unsigned int instruction_count;
+  unsigned long long file_size;
+};
+
+typedef struct bytecode_section_t {
+  unsigned int kind;
+  unsigned int count;
+  unsigned long long offset;                // from the start of the file, page aligned
+  unsigned long long size;                  // bytes used, the section is padded to a page
+};
+
+typedef struct bytecode_label_t {
+  unsigned int name;                        // offset of the name in the constant pool
+  int index;                                // instruction the label points at
+  unsigned int offset;                      // its byte offset in the bytecode
+};
+
+// what the writer is given, names are copied into the constant pool
+typedef struct program_label_t {
+  const char* name;
+  int index;
+};
+
+// a loaded file. everything points into 'data', the file mapped read-only,
+// so the page cache is shared by every process that loads the same file.
+typedef struct bytecode_file_t {
+  int fd;                                   // kept open to map the bytecode into each cpu, -1 without mmap
+  unsigned char* data;
+  size_t size;
+  const unsigned char* bytecode;
+  size_t bytecode_offset;                   // of the bytecode section in the file
+  size_t bytecode_length;
+  op_decoded_program_t decoded;             // instructions point into 'data', never free them
+  const bytecode_label_t* labels;
+  int label_count;
+  const char* constants;
+  size_t constants_size;
+
+  const char* label_name(int idx) const;
+  int find_label(const char* name) const;   // instruction index, -1 if there is no such label
+};
+
+bool write_bytecode_file(const char* path, const op_program_t* program, const program_label_t* labels, int label_count);
+bytecode_file_t* load_bytecode_file(const char* path);
+void free_bytecode_file(bytecode_file_t* file);
+
+#endif // __BYTECODE_H__
\ No newline at end of file
@@ -0,0 +1,1608 @@
+#ifndef __CPU_H__
+#define __CPU_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "binary.h"
+#include "opcodes.h"
+#include "ilbuilder.h"
+#include "decoder.h"
+#include "machine.h"
+#include "jit.h"
+#include "aot.h"
+#include "heap.h"
+#include "trace.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "bytecode.h"
+#include "verifier.h"
+#include "interrupt.h"
+
+#include <algorithm>
+#include <chrono>
+
+struct cpu_t {
+    op_program_t* program;
+    op_decoded_program_t* decoded;
+    jit_program_t* jit;
+    aot_program_t* aot;
+    const interrupt_table_t* interrupts;    // INT dispatch, default_interrupt_table() unless replaced
+    host_io_t io;                           // buffered guest output, flushed when a run ends
+    void** threaded_code;                   // handler address per decoded instruction, built on first use
+    profile_t* profile;                     // non-NULL turns on execute_profiled()
+    bool owns_decoded;                      // false when 'decoded' is borrowed (snapshot, program file)
+    bool owns_jit;                          // same for 'jit'
+    bool owns_aot;                          // and 'aot'
+    cpu_info_t* info;
+    cpu_engine_t engine;
+    int resume_at;                          // where the current run continues (engine specific), -1 when halted
+    unsigned int slice_start;               // total_run_cycles when the current slice began
+    unsigned int slice_budget;              // instructions the current slice may run before yielding
+    unsigned char* memory;                  // 'memory_size' bytes, then the heap tables (see mapping_size())
+    unsigned int memory_size;
+    unsigned int registers[REGISTER_SIZE];
+    unsigned int flags_lhs;                 // operands of the last compare while its ZF/SF are held back
+    unsigned int flags_rhs;
+    bool flags_pending;                     // ZF/SF don't reflect that compare yet, see materialize_flags()
+    heap_t heap;
+
+#pragma region Memory
+    bool asm_misvalid(int idx) {
+        return (idx >= 0 && idx <= (int)memory_size);
+    }
+
+    void* asm_mofaddr(int idx) {
+        return NULL;
+    }
+
+    // allocation and free are O(1) amortized, the block bookkeeping lives in
+    // 'heap' (see heap.h) rather than in markers inside guest memory
+    void* asm_malloc(int size) {
+        int idx = heap.allocate(size);
+        if (idx < 0) {
+            LOG_DEBUG("[D] No space found for memory of size : " << size);
+            return NULL;
+        }
+
+        return &memory[idx];
+    }
+
+    void asm_mfree(void* ptr) {
+        if (ptr == NULL) {
+            LOG_DEBUG("[D] Invalid pointer provided to free");
+            return;
+        }
+
+        unsigned char* p = static_cast<unsigned char*>(ptr);
+        int idx = p - memory;
+        if (idx < 0 || idx >= (int)memory_size) {
+            LOG_DEBUG("[D] Invalid pointer range");
+            return;
+        }
+
+        if (!heap.release(idx)) {
+            LOG_DEBUG("[D] Pointer is not an allocated block: " << idx);
+        }
+    }
+
+    int asm_maddrof(void* ptr) {
+        if (ptr == NULL) {
+            LOG_DEBUG("[D] Invalid pointer provided to get address of");
+            return 0;
+        }
+
+        unsigned char* p = static_cast<unsigned char*>(ptr);
+        return std::max(0, static_cast<int>(p - memory));
+    }
+
+    void dump_memory(int startIndex, int chunkLimit) {
+        const int CHUNK_SIZE = 15;
+        if (startIndex < 0 || startIndex >= (int)memory_size) {
+            LOG_ERROR("[ERROR] Invalid startIndex: " << startIndex);
+            return;
+        }
+
+        int endIndex = startIndex + (chunkLimit * CHUNK_SIZE);
+        if (endIndex > (int)memory_size) {
+            endIndex = (int)memory_size;
+        }
+
+        LOG_MSG("======= MEM DUMP (" << (endIndex - startIndex) << " TOTAL) =======");
+        for (int i = startIndex; i < endIndex; i += CHUNK_SIZE) {
+            printf("0x%08X: ", i);
+            for (int j = 0; j < CHUNK_SIZE; ++j) {
+                if (i + j < endIndex) {
+                    printf("%02X ", memory[i + j]);
+                } else {
+                    printf("   ");
+                }
+            }
+
+            printf(" | ");
+            for (int j = 0; j < CHUNK_SIZE; ++j) {
+                if (i + j < endIndex) {
+                    unsigned char byte = memory[i + j];
+                    if (isprint(byte)) {
+                        printf("%c", byte);
+                    } else {
+                        printf("~");
+                    }
+                }
+            }
+            printf("\n");
+        }
+        LOG_MSG("===============================================");
+    }
+#pragma endregion
+
+#pragma region Stack
+
+    // the stack is an array of native-endian words at the bottom of guest
+    // memory. SP starts at 0 and moves by whole words, so (unless a program
+    // that failed verification moved it) every slot is word aligned and a
+    // push or pop is one load or store
+    void stack_store(unsigned int sp, int value) {
+        memcpy(&memory[sp], &value, sizeof(int));
+    }
+
+    int stack_load(unsigned int sp) {
+        int value;
+        memcpy(&value, &memory[sp], sizeof(int));
+        return value;
+    }
+
+    // 'Verified' drops the overflow/underflow tests, for programs where
+    // verify_program() already proved SP stays inside the stack
+    template<bool Verified = false> void asm_stack_push(int value) {
+        if (!Verified && registers[SP] >= STACK_SIZE) {
+            LOG_ERROR("[ERROR] Stack overflow");
+            return;
+        }
+
+        stack_store(registers[SP], value);
+        registers[SP] += sizeof(int);
+    }
+
+    // an unverified SP can be anything (MOVI writes it like any register), so
+    // the pop is bounded on both sides rather than trusting validate() ran first
+    template<bool Verified = false> int asm_stack_pop() {
+        if (!Verified && registers[SP] < sizeof(int)) {
+            LOG_ERROR("[ERROR] Stack underflow");
+            return 0;
+        }
+        if (!Verified && registers[SP] > STACK_SIZE) {
+            LOG_ERROR("[ERROR] Stack pointer out of bounds");
+            return 0;
+        }
+
+        registers[SP] -= sizeof(int);
+        return stack_load(registers[SP]);
+    }
+
+    // MOVI is a fused PUSH imm; POP reg. the value never round-trips through
+    // the stack slot, unless the push would overflow, where the pair is
+    // replayed so the error (and what ends up in the register) stays the same
+    template<bool Verified = false> void asm_move_immediate(int registerIdx, int value) {
+        if (!Verified && registers[SP] >= STACK_SIZE) {
+            asm_stack_push(value);
+            value = asm_stack_pop();
+        }
+        registers[registerIdx] = value;
+    }
+
+    // LOAD/STORE move a native-endian word like the stack does. the address
+    // wraps at 32 bits and the whole word has to be inside guest memory, the
+    // heap tables after it aren't the guest's. it's only known at run time,
+    // so this is checked on verified programs too
+    bool memory_in_bounds(unsigned int address) {
+        if (address <= memory_size - sizeof(int))
+            return true;
+
+        LOG_ERROR("[-] -> Memory access out of bounds at 0x" << std::hex << address << std::dec);
+        return false;
+    }
+
+    void asm_load(int registerIdx, unsigned int address) {
+        if (memory_in_bounds(address)) {
+            memcpy(&registers[registerIdx], &memory[address], sizeof(int));
+        }
+    }
+
+    void asm_store(unsigned int address, unsigned int value) {
+        if (memory_in_bounds(address)) {
+            memcpy(&memory[address], &value, sizeof(int));
+        }
+    }
+
+    // runs the handler for 'interrupt_id', true if it ended the run. the
+    // verified engines count on INT leaving SP where it was, so a handler
+    // that moves SP or PC gets them put back
+    bool asm_interrupt(int interrupt_id) {
+        materialize_flags();
+        const unsigned int sp = registers[SP];
+        const unsigned int pc = registers[PC];
+        interrupt_context_t context = { registers, memory, memory_size, &io, NULL };
+        const bool halt = dispatch_interrupt(interrupts, interrupt_id, &context) == INTERRUPT_HALT;
+        if (registers[SP] != sp || registers[PC] != pc) {
+            LOG_WARN("[!] Interrupt 0x" << std::hex << interrupt_id << std::dec << " handler changed SP or PC, restoring them");
+            registers[SP] = sp;
+            registers[PC] = pc;
+        }
+        return halt;
+    }
+
+#pragma endregion
+
+#pragma region Flags
+
+    // CMP is the only instruction that sets flags, ZF = lhs == rhs and SF =
+    // the sign of lhs - rhs. mostly the only thing reading them is the JE/JNE
+    // right after it, so a compare just records its operands and the jumps
+    // test those. ZF/SF are written when the slice ends, or right away for a
+    // compare the decoder marked 'eager_flags' (its flags may be read by name)
+    void asm_compare(const op_decoded_t* inst, unsigned int lhs, unsigned int rhs) {
+        flags_lhs = lhs;
+        flags_rhs = rhs;
+        flags_pending = true;
+        if (inst->eager_flags) {
+            materialize_flags();
+        }
+    }
+
+    void materialize_flags() {
+        if (!flags_pending)
+            return;
+
+        registers[ZF] = flags_lhs == flags_rhs;
+        registers[SF] = (flags_lhs - flags_rhs) >> 31;
+        flags_pending = false;
+    }
+
+    // what JE/JNE test, a program may also have set ZF itself
+    bool zero_flag() {
+        return flags_pending ? flags_lhs == flags_rhs : registers[ZF] != 0;
+    }
+
+    // a taken jump ends the basic block, the only place a slice is cut short.
+    // 'Profiled' counts it for execute_profiled(), the other engines skip that
+    template<bool Profiled = false> int asm_jump(int target) {
+        if constexpr (Profiled) {
+            profile->record_jump(target);
+        }
+        if (this->info->total_run_cycles - slice_start >= slice_budget) {
+            resume_at = target;
+            return CPU_YIELD;
+        }
+        return target;
+    }
+
+#pragma endregion
+
+    // one mapping per cpu, guest memory first and the heap tables after it
+    size_t mapping_size() {
+        return page_align(memory_size) + page_align(heap_t::tables_size(memory_size - STACK_SIZE));
+    }
+
+    unsigned int* heap_tables() {
+        return (unsigned int*)(memory + page_align(memory_size));
+    }
+
+    // a fresh mapping reads as zeroes without a single page backed, so there
+    // is nothing to clear and untouched memory never costs anything.
+    // everything past the stack belongs to the heap
+    void initialize_memory() {
+        heap.init(STACK_SIZE, memory_size - STACK_SIZE, heap_tables());
+        LOG_MSG("[+] Initialized memory");
+    }
+
+    void initialize_registers() {
+        // clean registers to fresh slate
+        for (int i = 0; i < REGISTER_SIZE; ++i) {
+            registers[i] = 0x00;
+        }
+
+        registers[SP] = 0x00;
+        flags_pending = false;
+        LOG_MSG("[+] Initialized registers");
+    }
+
+    // serialized size of the program, so the image can be written
+    // straight into guest memory without a staging stream
+    size_t get_bytecode_size() {
+        return (size_t)program->length * (sizeof(unsigned char) + sizeof(int)) + program->operands_length;
+    }
+
+    bool initialize_bytecode() {
+        const size_t bytecode_size = get_bytecode_size();
+        char* bytecode_ptr = (char*)asm_malloc(bytecode_size);
+        if (bytecode_ptr == NULL) {
+            LOG_ERROR("[-] Bytecode does not fit in guest memory (" << bytecode_size << " bytes)");
+            return false;
+        }
+
+        auto stream_ptr = create_binary_span((unsigned char*)bytecode_ptr, bytecode_size);
+        if (stream_ptr == NULL) {
+            LOG_ERROR("[-] Failed to create binary stream");
+            return false;
+        }
+
+        for (int i = 0; i < program->length; ++i) {
+            stream_ptr->write_uint8(program->types[i]);
+            stream_ptr->write_int32(program->lengths[i]);
+            stream_ptr->append(program->operands_of(i), program->operands_size(i));
+        }
+
+        registers[PC] = asm_maddrof(bytecode_ptr);
+        registers[PX] = (registers[PC] + stream_ptr->length);
+        this->info->program_counter_lower_bound = registers[PC];
+        this->info->program_counter_higher_bound = registers[PX]; 
+
+        LOG_MSG("[+] Initialized bytecode (" << program->length << " instructions written)");
+        free_binary_stream(stream_ptr);
+        return true;
+    }
+
+    // the bytecode has to start on a page to be mapped, so the heap block is
+    // one page bigger than the (page rounded) bytecode and the start is aligned in it
+    bool map_bytecode(const bytecode_file_t* file) {
+        const size_t mapped_size = page_align(file->bytecode_length);
+        unsigned char* block = (unsigned char*)asm_malloc((int)(mapped_size + MEMORY_PAGE_SIZE));
+        if (block == NULL) {
+            LOG_ERROR("[-] Bytecode does not fit in guest memory (" << file->bytecode_length << " bytes)");
+            return false;
+        }
+
+        unsigned char* start = memory + page_align(block - memory);
+        if (mapped_size > 0 && !map_file_pages(start, mapped_size, file->fd, file->bytecode_offset, file->bytecode)) {
+            return false;
+        }
+
+        registers[PC] = (unsigned int)(start - memory);
+        registers[PX] = registers[PC] + (unsigned int)file->bytecode_length;
+        this->info->program_counter_lower_bound = registers[PC];
+        this->info->program_counter_higher_bound = registers[PX];
+
+        LOG_MSG("[+] Mapped bytecode (" << file->decoded.length << " instructions)");
+        return true;
+    }
+
+    // decode and verify once, straight out of memory. done on the first
+    // execute() so the in-place engine never pays for it
+    bool ensure_decoded() {
+        if (decoded != NULL)
+            return true;
+
+        decoded = decode_bytecode(&memory[this->info->program_counter_lower_bound],
+                                  this->info->program_counter_higher_bound - this->info->program_counter_lower_bound);
+        if (decoded == NULL) {
+            LOG_ERROR("[-] Failed to decode bytecode");
+            return false;
+        }
+
+        verify_report_t report;
+        if (verify_program(decoded, &report)) {
+            LOG_MSG("[+] Verified program (max stack depth " << report.max_stack_depth << " bytes)");
+        } else {
+            LOG_DEBUG("[D] Program not verified, instruction " << report.failed_at << ": " << report.reason);
+        }
+        return true;
+    }
+
+    // everything but the program image, false if there is no guest memory
+    bool initialize_state(op_program_t* program, unsigned int memory_size) {
+        this->program = program;
+        this->memory_size = (unsigned int)page_align(std::clamp(memory_size, (unsigned int)(STACK_SIZE + MEMORY_PAGE_SIZE),
+                                                                (unsigned int)MEMORY_MAX_SIZE));
+        this->decoded = NULL;
+        this->jit = NULL;
+        this->aot = NULL;
+        this->interrupts = default_interrupt_table();
+        this->io = {};
+        this->threaded_code = NULL;
+        this->profile = NULL;
+        this->owns_decoded = true;
+        this->owns_jit = true;
+        this->owns_aot = true;
+        this->engine = ENGINE_SWITCH;
+        this->resume_at = -1;
+        this->slice_start = 0;
+        this->slice_budget = UINT_MAX;
+        this->info = (cpu_info_t*)malloc(sizeof(cpu_info_t));
+        memset(this->info, 0, sizeof(cpu_info_t));
+
+        this->memory = map_pages(mapping_size(), NULL);
+        if (this->memory == NULL) {
+            LOG_ERROR("[-] No guest memory to initialize");
+            return false;
+        }
+
+        initialize_memory();
+        initialize_registers();
+        return true;
+    }
+
+    // 'memory_size' is the guest address space, rounded to whole pages. false
+    // if the program couldn't be loaded, release() still has to be called
+    bool initialize(op_program_t* program, unsigned int memory_size = MEMORY_SIZE) {
+        return initialize_state(program, memory_size) && initialize_bytecode();
+    }
+
+    // runs a loaded bytecode file as is: its bytecode section is mapped into
+    // guest memory and its decoded section borrowed, nothing is written out or
+    // decoded. the file has to outlive the cpu
+    bool initialize(const bytecode_file_t* file, unsigned int memory_size = MEMORY_SIZE) {
+        if (!initialize_state(NULL, memory_size) || !map_bytecode(file))
+            return false;
+
+        share_code(const_cast<op_decoded_program_t*>(&file->decoded), NULL, NULL);
+        return true;
+    }
+
+    // puts the cpu back at the first instruction with clean registers, the
+    // loaded image, heap and decoded/jit'd code are kept
+    void reset() {
+        initialize_registers();
+        registers[PC] = this->info->program_counter_lower_bound;
+        registers[PX] = this->info->program_counter_higher_bound;
+        resume_at = -1;
+    }
+
+    // runs on code decoded (and jit'd) by another cpu that loaded the same
+    // program. all of it is read-only while executing, and release() leaves it alone.
+    // without a jit (or aot module), one compiled later belongs to this cpu
+    void share_code(op_decoded_program_t* decoded, jit_program_t* jit, aot_program_t* aot) {
+        this->decoded = decoded;
+        this->jit = jit;
+        this->aot = aot;
+        this->owns_decoded = false;
+        this->owns_jit = jit == NULL;
+        this->owns_aot = aot == NULL;
+    }
+
+#pragma region Snapshots
+
+    // freezes memory, registers, heap and the run in progress. the decoded
+    // (and jit'd) code moves into the snapshot, this cpu borrows it from then
+    // on, so the snapshot must be freed after this cpu and all of its forks
+    cpu_snapshot_t* snapshot() {
+        if (!ensure_decoded())
+            return NULL;
+
+        if (engine == ENGINE_JIT && jit == NULL) {
+            jit = jit_compile(decoded);
+            owns_jit = true;
+        }
+        if (engine == ENGINE_AOT && aot == NULL) {
+            aot = aot_compile(decoded);
+            owns_aot = true;
+        }
+
+        // forks start with nothing pending, what this cpu printed so far goes out now
+        io.flush();
+
+        auto snapshot = (cpu_snapshot_t*)malloc(sizeof(cpu_snapshot_t));
+        if (snapshot == NULL) {
+            LOG_ERROR("[-] Failed to allocate memory for cpu_snapshot_t");
+            return NULL;
+        }
+
+        snapshot->pages = create_page_image(memory, mapping_size());
+        if (snapshot->pages == NULL) {
+            free(snapshot);
+            return NULL;
+        }
+
+        snapshot->memory_size = memory_size;
+        snapshot->program = program;
+        snapshot->decoded = decoded;
+        snapshot->jit = jit;
+        snapshot->aot = aot;
+        snapshot->interrupts = interrupts;
+        snapshot->owns_decoded = owns_decoded;
+        snapshot->owns_jit = owns_jit && jit != NULL;
+        snapshot->owns_aot = owns_aot && aot != NULL;
+        snapshot->info = *info;
+        snapshot->engine = engine;
+        snapshot->resume_at = resume_at;
+        memcpy(snapshot->registers, registers, sizeof(registers));
+        snapshot->heap = heap;
+
+        owns_decoded = false;
+        owns_jit = jit == NULL;
+        owns_aot = aot == NULL;
+        return snapshot;
+    }
+
+    void load_snapshot_state(const cpu_snapshot_t* snapshot) {
+        if (jit != snapshot->jit && owns_jit) {
+            jit_free(jit);
+        }
+        if (aot != snapshot->aot && owns_aot) {
+            aot_free(aot);
+        }
+        if (decoded != snapshot->decoded) {
+            if (owns_decoded) {
+                free_decoded_program(decoded);
+            }
+            free(threaded_code);
+            threaded_code = NULL;
+        }
+
+        share_code(snapshot->decoded, snapshot->jit, snapshot->aot);
+        this->program = snapshot->program;
+        this->interrupts = snapshot->interrupts;
+        (*info) = snapshot->info;
+        engine = snapshot->engine;
+        resume_at = snapshot->resume_at;
+        memcpy(registers, snapshot->registers, sizeof(registers));
+        flags_pending = false;
+        heap = snapshot->heap;
+        heap.attach(heap_tables());
+    }
+
+    // starts this (uninitialized) cpu where the snapshot was taken. memory is
+    // a copy-on-write view of the snapshot's, a page is only copied once the
+    // fork writes to it
+    bool fork(const cpu_snapshot_t* snapshot) {
+        this->decoded = NULL;
+        this->jit = NULL;
+        this->aot = NULL;
+        this->io = {};
+        this->threaded_code = NULL;
+        this->profile = NULL;
+        this->owns_decoded = false;
+        this->owns_jit = false;
+        this->owns_aot = false;
+        this->slice_start = 0;
+        this->slice_budget = UINT_MAX;
+        this->memory_size = snapshot->memory_size;
+        this->info = (cpu_info_t*)malloc(sizeof(cpu_info_t));
+        this->memory = map_pages(mapping_size(), snapshot->pages);
+        if (this->info == NULL || this->memory == NULL) {
+            LOG_ERROR("[-] Failed to fork cpu from snapshot");
+            free(this->info);
+            unmap_pages(this->memory, mapping_size());
+            this->info = NULL;
+            this->memory = NULL;
+            return false;
+        }
+
+        load_snapshot_state(snapshot);
+        return true;
+    }
+
+    // puts an initialized cpu back to the snapshot. the pages written since
+    // are dropped rather than copied back, so this costs what the run dirtied
+    bool restore(const cpu_snapshot_t* snapshot) {
+        if (memory_size != snapshot->memory_size) {
+            unmap_pages(memory, mapping_size());
+            memory_size = snapshot->memory_size;
+            memory = map_pages(mapping_size(), snapshot->pages);
+            if (memory == NULL)
+                return false;
+        } else if (!remap_pages(memory, mapping_size(), snapshot->pages)) {
+            return false;
+        }
+
+        load_snapshot_state(snapshot);
+        return true;
+    }
+
+#pragma endregion
+
+    // switches execute() over to execute_profiled(), the report is printed at the end of every run
+    bool enable_profile(bool json) {
+        if (!ensure_decoded())
+            return false;
+
+        free_profile(profile);
+        profile = create_profile(decoded->length, json);
+        return profile != NULL;
+    }
+
+    // frees everything initialize() and execute() allocated, not the cpu or program
+    void release() {
+        if (owns_jit) {
+            jit_free(jit);
+        }
+        if (owns_aot) {
+            aot_free(aot);
+        }
+        if (owns_decoded) {
+            free_decoded_program(decoded);
+        }
+        free(threaded_code);
+        free_profile(profile);
+        free(info);
+        io.release();
+        unmap_pages(memory, mapping_size());
+        memory = NULL;
+        jit = NULL;
+        aot = NULL;
+        threaded_code = NULL;
+        profile = NULL;
+        decoded = NULL;
+        info = NULL;
+    }
+
+    template<typename T> T get_operand(const unsigned char* bytecode, size_t& pc) {
+        T operand;
+        memcpy(&operand, &bytecode[pc], sizeof(T));
+        pc += sizeof(T);
+        return operand;
+    }
+
+    void validate() {
+        if (registers[SP] > STACK_SIZE)
+            throw std::runtime_error("Register 'SP' (Stack Pointer) is out of bounds. The max size is 1024.");
+    }
+
+    // an instruction only runs with the operand count its handler expects,
+    // and with its first 'register_operands' operands indexing 'registers'.
+    // for a verified program that was proved once up front and this is a constant
+    template<bool Verified> bool well_formed(const op_decoded_t* inst, int length, int register_operands) {
+        if constexpr (Verified) {
+            return true;
+        }
+
+        if (inst->length != length)
+            return false;
+
+        for (int i = 0; i < register_operands; ++i) {
+            if ((unsigned int)inst->operands[i] >= (unsigned int)REGISTER_SIZE) {
+                LOG_ERROR("[-] -> Bad register operand " << inst->operands[i] << " at offset " << inst->offset);
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    // DIVI by an immediate 0, verify_program() turns those away up front
+    template<bool Verified> bool nonzero_divisor(const op_decoded_t* inst) {
+        if (Verified || inst->operands[1] != 0)
+            return true;
+
+        return division_by_zero(inst);
+    }
+
+    // DIV by a register holding 0, which the verifier can't rule out, so
+    // this one is checked on every engine
+    bool nonzero_register(const op_decoded_t* inst) {
+        if (registers[inst->operands[1]] != 0)
+            return true;
+
+        return division_by_zero(inst);
+    }
+
+    bool division_by_zero(const op_decoded_t* inst) {
+        LOG_ERROR("[-] -> Division by zero at offset " << inst->offset);
+        return false;
+    }
+
+    // execute() and execute_inst() should be tied together
+    // meaning that execute_inst() should be able to control
+    // the next location of memory to execute, whereas now it can
+    // only execute each memory code sequentially.
+    // 
+    // this can be catastropic because it will also attempt
+    // to execute operands as opcodes. not good :(
+    // FIXED: 09/01/2025 nexusverypro
+    // FIXME(FIXED): still not working? 10/01/2025 nexusverypro
+    //
+    // execute_inst() now runs over the pre-decoded instructions made by
+    // decode_bytecode(), so operands are never re-read from the byte stream.
+    // returns the index of the next instruction to execute, or CPU_YIELD
+    // (with resume_at set to the jump target) once the slice budget is spent.
+    // execute_inst<true>() is the unchecked version for verified programs.
+    template<bool Verified = false, bool Profiled = false> int execute_inst(const op_decoded_t* inst) {
+        if constexpr (!Verified) {
+            validate(); // validate our cpu
+        }
+
+        this->info->total_run_cycles++;
+        registers[PC] = this->info->program_counter_lower_bound + inst->offset;
+        return execute_op<Verified, Profiled>(inst);
+    }
+
+    // the instruction itself, without the per-step bookkeeping above. the
+    // block engine does that once per block instead, and needs this inlined
+    // into its loop: called out of line it costs as much as the bookkeeping saves
+    template<bool Verified, bool Profiled = false> CEMU_ALWAYS_INLINE int execute_op(const op_decoded_t* inst) {
+        const unsigned char op_code = inst->type;
+        const int* operands = inst->operands;
+        TRACE_EVENT(TRACE_EXECUTE, inst->offset, op_code);
+
+        switch (op_code) {
+            case PUSH: {
+                if (well_formed<Verified>(inst, 1, 0)) {
+                    asm_stack_push<Verified>(operands[0]);
+                }
+                break;
+            }
+
+            case POP: {
+                if (well_formed<Verified>(inst, 1, 1)) {
+                    int value = asm_stack_pop<Verified>();
+                    registers[operands[0]] = value;
+                }
+                break;
+            }
+
+            case MOVI: {
+                if (well_formed<Verified>(inst, 2, 1)) {
+                    asm_move_immediate<Verified>(operands[0], operands[1]);
+                }
+                break;
+            }
+
+            case ADD: {
+                if (well_formed<Verified>(inst, 2, 2)) {
+                    int value = registers[operands[0]] + registers[operands[1]];
+                    registers[operands[0]] = value;
+                }
+                break;
+            }
+
+            case SUB: {
+                if (well_formed<Verified>(inst, 2, 2)) {
+                    int value = registers[operands[0]] - registers[operands[1]];
+                    registers[operands[0]] = value;
+                }
+                break;
+            }
+
+            case MUL: {
+                if (well_formed<Verified>(inst, 2, 2)) {
+                    int value = registers[operands[0]] * registers[operands[1]];
+                    registers[operands[0]] = value;
+                }
+                break;
+            }
+
+            case DIV: {
+                if (well_formed<Verified>(inst, 2, 2) && nonzero_register(inst)) {
+                    int value = registers[operands[0]] / registers[operands[1]];
+                    registers[operands[0]] = value;
+                }
+                break;
+            }
+
+            case OR: {
+                if (well_formed<Verified>(inst, 2, 2)) {
+                    int value = registers[operands[0]] | registers[operands[1]];
+                    registers[operands[0]] = value;
+                }
+                break;
+            }
+
+            case XOR: {
+                if (well_formed<Verified>(inst, 2, 2)) {
+                    int value = registers[operands[0]] ^ registers[operands[1]];
+                    registers[operands[0]] = value;
+                }
+                break;
+            }
+
+            case AND: {
+                if (well_formed<Verified>(inst, 2, 2)) {
+                    int value = registers[operands[0]] & registers[operands[1]];
+                    registers[operands[0]] = value;
+                }
+                break;
+            }
+
+            case ADDI: {
+                if (well_formed<Verified>(inst, 2, 1)) {
+                    registers[operands[0]] = registers[operands[0]] + (unsigned int)operands[1];
+                }
+                break;
+            }
+
+            case SUBI: {
+                if (well_formed<Verified>(inst, 2, 1)) {
+                    registers[operands[0]] = registers[operands[0]] - (unsigned int)operands[1];
+                }
+                break;
+            }
+
+            case MULI: {
+                if (well_formed<Verified>(inst, 2, 1)) {
+                    registers[operands[0]] = registers[operands[0]] * (unsigned int)operands[1];
+                }
+                break;
+            }
+
+            case DIVI: {
+                if (well_formed<Verified>(inst, 2, 1) && nonzero_divisor<Verified>(inst)) {
+                    registers[operands[0]] = registers[operands[0]] / (unsigned int)operands[1];
+                }
+                break;
+            }
+
+            case ANDI: {
+                if (well_formed<Verified>(inst, 2, 1)) {
+                    registers[operands[0]] = registers[operands[0]] & (unsigned int)operands[1];
+                }
+                break;
+            }
+
+            case ORI: {
+                if (well_formed<Verified>(inst, 2, 1)) {
+                    registers[operands[0]] = registers[operands[0]] | (unsigned int)operands[1];
+                }
+                break;
+            }
+
+            case XORI: {
+                if (well_formed<Verified>(inst, 2, 1)) {
+                    registers[operands[0]] = registers[operands[0]] ^ (unsigned int)operands[1];
+                }
+                break;
+            }
+
+            case LOAD: {
+                if (well_formed<Verified>(inst, 3, 2)) {
+                    asm_load(operands[0], registers[operands[1]] + (unsigned int)operands[2]);
+                }
+                break;
+            }
+
+            case STORE: {
+                if (well_formed<Verified>(inst, 3, 2)) {
+                    asm_store(registers[operands[1]] + (unsigned int)operands[2], registers[operands[0]]);
+                }
+                break;
+            }
+
+            case CMP: {
+                if (well_formed<Verified>(inst, 2, 2)) {
+                    asm_compare(inst, registers[operands[0]], registers[operands[1]]);
+                }
+                break;
+            }
+
+            case JMP: {
+                // target was resolved by the decoder, -1 means the jump
+                // pointed outside the program or into the middle of an instruction
+                if (well_formed<Verified>(inst, 1, 0) && (Verified || inst->target >= 0)) {
+                    return asm_jump<Profiled>(inst->target);
+                }
+                break;
+            }
+
+            case JE:
+            case JNE: {
+                if (well_formed<Verified>(inst, 1, 0) && (Verified || inst->target >= 0) &&
+                    zero_flag() == (op_code == JE)) {
+                    return asm_jump<Profiled>(inst->target);
+                }
+                break;
+            }
+
+            case CMPJE:
+            case CMPJNE: {
+                if (well_formed<Verified>(inst, 3, 2)) {
+                    const unsigned int lhs = registers[operands[0]];
+                    const unsigned int rhs = registers[operands[1]];
+                    asm_compare(inst, lhs, rhs);
+                    if ((Verified || inst->target >= 0) && (lhs == rhs) == (op_code == CMPJE)) {
+                        return asm_jump<Profiled>(inst->target);
+                    }
+                }
+                break;
+            }
+
+            case INT: {
+                if (well_formed<Verified>(inst, 1, 0) && asm_interrupt(operands[0])) {
+                    return CPU_EXIT;
+                }
+                break;
+            }
+
+            default: {
+                TRACE_EVENT(TRACE_UNKNOWN, inst->offset, op_code);
+                LOG_ERROR("[-] -> Unknown opcode: " << (int)op_code);
+                break;
+            }
+        }
+
+        return inst->next;
+    }
+
+#if CEMU_HAS_COMPUTED_GOTO
+    // direct-threaded version of execute_inst(). every decoded instruction gets
+    // the address of its handler, and each handler jumps straight to the
+    // handler of the next instruction, so there is no shared dispatch branch.
+    // the entry past the end of the program points at the halt handler, which
+    // replaces the PC/PX test that the switch engine does per step. validate()
+    // only runs at entry and halt, an unverified PUSH/POP bounds SP itself.
+    // threaded_code holds labels of one instantiation, a cpu only ever runs the
+    // one that matches decoded->verified.
+    //
+    // verified programs also cache the top of the stack in a local across
+    // dispatches. there are two dispatch tables: 'code' for when the stack is
+    // all in memory and 'cached' for when its top word lives in 'tos' instead.
+    // only PUSH and POP differ between them, they move between the tables, and
+    // every other handler dispatches through whichever one it was entered from.
+    // so PUSH imm ... POP reg never touches memory, and the word is only
+    // written back when a second PUSH needs the cache or the slice ends.
+    // SP always counts the cached word, only its memory slot is stale. words
+    // above SP are garbage on every engine, a popped word may never have been stored.
+    template<bool Verified> int execute_threaded(int idx) {
+        const int length = decoded->length;
+        const op_decoded_t* instructions = decoded->instructions;
+
+        if (threaded_code == NULL) {
+            void* op_labels[256];
+            for (int i = 0; i < 256; ++i) {
+                op_labels[i] = &&op_unknown;
+            }
+            op_labels[PUSH] = &&op_push;
+            op_labels[POP]  = &&op_pop;
+            op_labels[MOVI] = &&op_movi;
+            op_labels[ADD]  = &&op_add;
+            op_labels[SUB]  = &&op_sub;
+            op_labels[MUL]  = &&op_mul;
+            op_labels[DIV]  = &&op_div;
+            op_labels[OR]   = &&op_or;
+            op_labels[XOR]  = &&op_xor;
+            op_labels[JMP]  = &&op_jmp;
+            op_labels[CMP]  = &&op_cmp;
+            op_labels[JE]   = &&op_je;
+            op_labels[JNE]  = &&op_jne;
+            op_labels[CMPJE] = &&op_cmpje;
+            op_labels[CMPJNE] = &&op_cmpjne;
+            op_labels[INT]  = &&op_int;
+            op_labels[AND]  = &&op_and;
+            op_labels[ADDI] = &&op_addi;
+            op_labels[SUBI] = &&op_subi;
+            op_labels[MULI] = &&op_muli;
+            op_labels[DIVI] = &&op_divi;
+            op_labels[ANDI] = &&op_andi;
+            op_labels[ORI]  = &&op_ori;
+            op_labels[XORI] = &&op_xori;
+            op_labels[LOAD] = &&op_load;
+            op_labels[STORE] = &&op_store;
+
+            const int tables = Verified ? 2 : 1;
+            threaded_code = (void**)malloc(sizeof(void*) * (length + 1) * tables);
+            if (threaded_code == NULL) {
+                LOG_DEBUG("[D] Failed to allocate threaded code");
+                return length;
+            }
+
+            for (int i = 0; i < length; ++i) {
+                threaded_code[i] = op_labels[instructions[i].type];
+            }
+            threaded_code[length] = &&op_halt;
+
+            // the cached handlers only run on verified programs, but their
+            // addresses are taken either way so <false> still uses the labels
+            void* const push_cached = &&op_push_cached;
+            void* const pop_cached = &&op_pop_cached;
+            if constexpr (Verified) {
+                op_labels[PUSH] = push_cached;
+                op_labels[POP]  = pop_cached;
+
+                void** cached = threaded_code + length + 1;
+                for (int i = 0; i < length; ++i) {
+                    cached[i] = op_labels[instructions[i].type];
+                }
+                cached[length] = &&op_halt;
+            }
+        }
+
+        void** const code = threaded_code;
+        void** const cached = threaded_code + length + 1;       // only for Verified
+        void** table = code;
+        unsigned int sp = registers[SP];
+        int tos = 0;
+
+        if constexpr (!Verified) {
+            validate();
+        }
+
+        const op_decoded_t* inst = NULL;
+        const unsigned int budget = slice_budget - (this->info->total_run_cycles - slice_start);
+        unsigned int cycles = 0;
+
+#define THREADED_DISPATCH()                                                         \
+        do {                                                                        \
+            inst = &instructions[idx];                                              \
+            goto *table[idx];                                                       \
+        } while (0)
+#define THREADED_NEXT()                                                             \
+        do {                                                                        \
+            idx = inst->next;                                                       \
+            THREADED_DISPATCH();                                                    \
+        } while (0)
+#define THREADED_BEGIN()                                                            \
+        cycles++;                                                                   \
+        TRACE_EVENT(TRACE_EXECUTE, inst->offset, inst->type)
+
+        THREADED_DISPATCH();
+
+    op_push:
+        THREADED_BEGIN();
+        if constexpr (Verified) {
+            tos = inst->operands[0];
+            sp += sizeof(int);
+            registers[SP] = sp;
+            table = cached;
+        } else if (well_formed<Verified>(inst, 1, 0)) {
+            asm_stack_push<Verified>(inst->operands[0]);
+        }
+        THREADED_NEXT();
+
+    op_push_cached:
+        THREADED_BEGIN();
+        stack_store(sp - sizeof(int), tos);
+        tos = inst->operands[0];
+        sp += sizeof(int);
+        registers[SP] = sp;
+        THREADED_NEXT();
+
+    op_pop:
+        THREADED_BEGIN();
+        if constexpr (Verified) {
+            sp -= sizeof(int);
+            registers[SP] = sp;
+            registers[inst->operands[0]] = stack_load(sp);
+        } else if (well_formed<Verified>(inst, 1, 1)) {
+            int value = asm_stack_pop<Verified>();
+            registers[inst->operands[0]] = value;
+        }
+        THREADED_NEXT();
+
+    op_pop_cached:
+        THREADED_BEGIN();
+        sp -= sizeof(int);
+        registers[SP] = sp;
+        registers[inst->operands[0]] = tos;
+        table = code;
+        THREADED_NEXT();
+
+    op_movi:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 1)) {
+            asm_move_immediate<Verified>(inst->operands[0], inst->operands[1]);
+        }
+        THREADED_NEXT();
+
+    op_add:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 2)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] + registers[inst->operands[1]];
+        }
+        THREADED_NEXT();
+
+    op_sub:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 2)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] - registers[inst->operands[1]];
+        }
+        THREADED_NEXT();
+
+    op_mul:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 2)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] * registers[inst->operands[1]];
+        }
+        THREADED_NEXT();
+
+    op_div:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 2) && nonzero_register(inst)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] / registers[inst->operands[1]];
+        }
+        THREADED_NEXT();
+
+    op_or:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 2)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] | registers[inst->operands[1]];
+        }
+        THREADED_NEXT();
+
+    op_xor:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 2)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] ^ registers[inst->operands[1]];
+        }
+        THREADED_NEXT();
+
+    op_and:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 2)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] & registers[inst->operands[1]];
+        }
+        THREADED_NEXT();
+
+    op_addi:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 1)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] + (unsigned int)inst->operands[1];
+        }
+        THREADED_NEXT();
+
+    op_subi:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 1)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] - (unsigned int)inst->operands[1];
+        }
+        THREADED_NEXT();
+
+    op_muli:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 1)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] * (unsigned int)inst->operands[1];
+        }
+        THREADED_NEXT();
+
+    op_divi:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 1) && nonzero_divisor<Verified>(inst)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] / (unsigned int)inst->operands[1];
+        }
+        THREADED_NEXT();
+
+    op_andi:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 1)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] & (unsigned int)inst->operands[1];
+        }
+        THREADED_NEXT();
+
+    op_ori:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 1)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] | (unsigned int)inst->operands[1];
+        }
+        THREADED_NEXT();
+
+    op_xori:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 1)) {
+            registers[inst->operands[0]] = registers[inst->operands[0]] ^ (unsigned int)inst->operands[1];
+        }
+        THREADED_NEXT();
+
+    // the address can be anywhere, the stack included, so a cached top of
+    // stack goes back to memory first like it does for INT
+    op_load:
+        THREADED_BEGIN();
+        if constexpr (Verified) {
+            if (table == cached) {
+                stack_store(sp - sizeof(int), tos);
+                table = code;
+            }
+        }
+        if (well_formed<Verified>(inst, 3, 2)) {
+            asm_load(inst->operands[0], registers[inst->operands[1]] + (unsigned int)inst->operands[2]);
+        }
+        THREADED_NEXT();
+
+    op_store:
+        THREADED_BEGIN();
+        if constexpr (Verified) {
+            if (table == cached) {
+                stack_store(sp - sizeof(int), tos);
+                table = code;
+            }
+        }
+        if (well_formed<Verified>(inst, 3, 2)) {
+            asm_store(registers[inst->operands[1]] + (unsigned int)inst->operands[2], registers[inst->operands[0]]);
+        }
+        THREADED_NEXT();
+
+    op_jmp:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 1, 0) && (Verified || inst->target >= 0)) {
+            goto taken_jump;
+        }
+        THREADED_NEXT();
+
+    op_cmp:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 2, 2)) {
+            asm_compare(inst, registers[inst->operands[0]], registers[inst->operands[1]]);
+        }
+        THREADED_NEXT();
+
+    op_je:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 1, 0) && (Verified || inst->target >= 0) && zero_flag()) {
+            goto taken_jump;
+        }
+        THREADED_NEXT();
+
+    op_jne:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 1, 0) && (Verified || inst->target >= 0) && !zero_flag()) {
+            goto taken_jump;
+        }
+        THREADED_NEXT();
+
+    op_cmpje:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 3, 2)) {
+            const unsigned int lhs = registers[inst->operands[0]];
+            const unsigned int rhs = registers[inst->operands[1]];
+            asm_compare(inst, lhs, rhs);
+            if ((Verified || inst->target >= 0) && lhs == rhs) {
+                goto taken_jump;
+            }
+        }
+        THREADED_NEXT();
+
+    op_cmpjne:
+        THREADED_BEGIN();
+        if (well_formed<Verified>(inst, 3, 2)) {
+            const unsigned int lhs = registers[inst->operands[0]];
+            const unsigned int rhs = registers[inst->operands[1]];
+            asm_compare(inst, lhs, rhs);
+            if ((Verified || inst->target >= 0) && lhs != rhs) {
+                goto taken_jump;
+            }
+        }
+        THREADED_NEXT();
+
+    // every jump handler lands here when it's taken
+    taken_jump:
+        idx = inst->target;
+        if (cycles >= budget) {
+            resume_at = idx;
+            idx = CPU_YIELD;
+            goto op_halt;
+        }
+        THREADED_DISPATCH();
+
+    op_int:
+        THREADED_BEGIN();
+        if constexpr (Verified) {
+            // the handler may read or write the stack, so the cached word goes back first
+            if (table == cached) {
+                stack_store(sp - sizeof(int), tos);
+                table = code;
+            }
+        }
+        if (well_formed<Verified>(inst, 1, 0) && asm_interrupt(inst->operands[0])) {
+            idx = CPU_EXIT;
+            goto op_halt;
+        }
+        THREADED_NEXT();
+
+    op_unknown:
+        THREADED_BEGIN();
+        TRACE_EVENT(TRACE_UNKNOWN, inst->offset, inst->type);
+        LOG_ERROR("[-] -> Unknown opcode: " << (int)inst->type);
+        THREADED_NEXT();
+
+    op_halt:
+#undef THREADED_BEGIN
+#undef THREADED_NEXT
+#undef THREADED_DISPATCH
+        this->info->total_run_cycles += cycles;
+        if constexpr (Verified) {
+            if (table == cached) {
+                stack_store(sp - sizeof(int), tos);
+            }
+        } else {
+            validate();
+        }
+        return idx;
+    }
+#endif
+
+    // runs jit'd code for as long as it can, every instruction the jit
+    // bailed on (INT, bad register index, stack over/underflow, a LOAD/STORE
+    // outside guest memory) is executed
+    // by execute_inst() before going back into native code. native code
+    // checks what is left of the budget on every taken jump.
+    int execute_jit(int idx) {
+        if (jit == NULL) {
+            return decoded->verified ? execute_switch<true>(idx) : execute_switch<false>(idx);
+        }
+
+        validate();
+
+        while (idx < decoded->length) {
+            // native code keeps ZF/SF in the registers, like every compare was eager
+            materialize_flags();
+            const unsigned int used = this->info->total_run_cycles - slice_start;
+            const unsigned int budget = used < slice_budget ? slice_budget - used : 0;
+            idx = jit->entry(registers, memory, jit->address_of(idx), &this->info->total_run_cycles, budget, memory_size);
+            TRACE_EVENT(TRACE_JIT_EXIT, idx, 0);
+            if (idx >= decoded->length)
+                break;
+
+            // out of budget (at a jump target, or at a bail) or an instruction left to the interpreter
+            if (this->info->total_run_cycles - slice_start >= slice_budget) {
+                resume_at = idx;
+                return CPU_YIELD;
+            }
+            idx = execute_inst(&decoded->instructions[idx]);
+        }
+        return idx;
+    }
+
+    // same loop as execute_jit() over the aot module, which is entered by
+    // instruction index. an index it has no entry for comes straight back and
+    // is stepped by execute_inst() until the module can take over again
+    int execute_aot(int idx) {
+        if (aot == NULL) {
+            return decoded->verified ? execute_switch<true>(idx) : execute_switch<false>(idx);
+        }
+
+        validate();
+
+        while (idx < decoded->length) {
+            materialize_flags();
+            const unsigned int used = this->info->total_run_cycles - slice_start;
+            const unsigned int budget = used < slice_budget ? slice_budget - used : 0;
+            idx = aot->entry(registers, memory, idx, &this->info->total_run_cycles, budget, memory_size);
+            TRACE_EVENT(TRACE_JIT_EXIT, idx, 0);
+            if (idx >= decoded->length)
+                break;
+
+            if (this->info->total_run_cycles - slice_start >= slice_budget) {
+                resume_at = idx;
+                return CPU_YIELD;
+            }
+            idx = execute_inst(&decoded->instructions[idx]);
+        }
+        return idx;
+    }
+
+    // reads every instruction straight out of cpu_t::memory through a borrowed
+    // view, nothing is copied or decoded ahead of time. slower per step than
+    // the decoded engines, but code patched in guest memory is seen right away.
+    // the op_decoded_t built here uses byte offsets for next/target, which
+    // execute_inst() hands back untouched, and so is 'position'.
+    int execute_inplace(int position) {
+        const unsigned int base = this->info->program_counter_lower_bound;
+        const size_t bytecode_length = this->info->program_counter_higher_bound - base;
+        binaryp_t* stream_ptr = create_binary_view(&memory[base], bytecode_length);
+        if (stream_ptr == NULL) {
+            LOG_DEBUG("[D] Failed to create binary stream");
+            return (int)bytecode_length;
+        }
+
+        stream_ptr->position = (size_t)position;
+        op_decoded_t inst;
+        while (stream_ptr->position < bytecode_length) {
+            if (stream_ptr->is_out_of_bounds(sizeof(unsigned char) + sizeof(int)))
+                break;
+
+            inst.offset = (int)stream_ptr->position;
+            inst.type = stream_ptr->read_uint8();
+            const int length = stream_ptr->read_int32();
+            if (length < 0 || stream_ptr->is_out_of_bounds((size_t)length * DECODED_OPERAND_SIZE))
+                break;
+
+            inst.length = (unsigned char)std::min(length, 0xFF);
+            for (int i = 0; i < length; ++i) {
+                int operand = stream_ptr->read_int32();
+                if (i < MAX_DECODED_OPERANDS) {
+                    inst.operands[i] = operand;
+                }
+            }
+
+            inst.next = (int)stream_ptr->position;
+            inst.target = -1;
+            const int operand = jump_operand(inst.type);
+            if (operand >= 0 && length == operand + 1 && inst.operands[operand] >= 0 &&
+                (size_t)inst.operands[operand] <= bytecode_length) {
+                inst.target = inst.operands[operand];
+            }
+
+            // nothing is decoded ahead, so no compare is known to be safe to hold back
+            inst.eager_flags = true;
+
+            stream_ptr->position = execute_inst(&inst);
+        }
+
+        position = stream_ptr->position == (size_t)CPU_YIELD ? CPU_YIELD : (int)stream_ptr->position;
+        free_binary_stream(stream_ptr);
+        return position;
+    }
+
+    // the switch engine with every instruction timed. the other engines don't
+    // have a per-instruction boundary to hook, so profiling always runs here.
+    // taken jumps are counted by asm_jump<true>(), inside the timed window
+    int execute_profiled(int idx) {
+        while (idx < decoded->length) {
+            const op_decoded_t* inst = &decoded->instructions[idx];
+            const unsigned long long start = trace_timestamp();
+            const int next = execute_inst<false, true>(inst);
+            profile->record(inst, idx, trace_timestamp() - start);
+            idx = next;
+        }
+        return idx;
+    }
+
+    template<bool Verified> int execute_switch(int idx) {
+        while (idx < decoded->length) {
+            idx = execute_inst<Verified>(&decoded->instructions[idx]);
+        }
+        return idx;
+    }
+
+    // execute_switch() a basic block at a time (see build_blocks()). a block
+    // is charged its cycles and validated once on entry, and its instructions
+    // run back to back through one inlined execute_op(), with no end of
+    // program test and no PC store (see machine.h). that isn't the switch
+    // engine's per-step validate(), SP can leave the stack inside a block, so
+    // an unverified PUSH/POP stays safe through its own bounds. only the
+    // last one can jump, and its successor comes straight from the block's
+    // links, so a loop goes block to block without going back through an index.
+    // the budget is still only looked at by a taken jump, which runs last in
+    // its block, so the cycle count it sees is the same as the switch engine's.
+    template<bool Verified> int execute_blocks(int idx) {
+        const op_decoded_t* instructions = decoded->instructions;
+        const op_block_t* blocks = decoded->blocks;
+        const op_block_t* end = &blocks[decoded->block_count];
+
+        // resuming mid-block (a host that moved PC or SP), step to the next block
+        while (idx < decoded->length && decoded->block_at[idx] < 0) {
+            idx = execute_inst<Verified>(&instructions[idx]);
+        }
+        if (idx >= decoded->length)
+            return idx;
+
+        const op_block_t* block = &blocks[decoded->block_at[idx]];
+        while (block != end) {
+            if constexpr (!Verified) {
+                validate();
+            }
+
+            this->info->total_run_cycles += block->count;
+
+            // a single call site, so the switch is inlined once
+            const op_decoded_t* inst = &instructions[block->first];
+            const op_decoded_t* last = inst + block->count - 1;
+            int next;
+            while (true) {
+                next = execute_op<Verified>(inst);
+                if (inst == last)
+                    break;
+                inst++;
+            }
+            if (next == last->next) {
+                block = &blocks[block->fallthrough];
+            } else if (next == last->target) {
+                block = &blocks[block->taken];
+            } else {
+                return next;                    // CPU_YIELD or CPU_EXIT
+            }
+        }
+        return decoded->length;
+    }
+
+    // the in-place engine works on byte offsets and never decodes, profiling
+    // needs the decoded program and always runs on the switch engine
+    bool runs_inplace() {
+        return engine == ENGINE_INPLACE && profile == NULL;
+    }
+
+    // everything a run needs before its first instruction, done once per run
+    // instead of once per slice. the engine should not change until the run halts,
+    // resume_at means something different to each of them.
+    bool begin_run() {
+        if (!runs_inplace()) {
+            if (!ensure_decoded()) {
+                LOG_DEBUG("[D] No decoded program to execute");
+                return false;
+            }
+
+            if (profile != NULL && engine != ENGINE_SWITCH) {
+                LOG_WARN("[!] Profiling runs on the switch engine, ignoring --engine=" << engine_name(engine));
+            }
+
+            if (profile == NULL && engine == ENGINE_JIT && jit == NULL) {
+                jit = jit_compile(decoded);
+                owns_jit = true;
+                if (jit == NULL) {
+                    LOG_WARN("[!] JIT unavailable, falling back to switch engine");
+                }
+            }
+
+            if (profile == NULL && engine == ENGINE_AOT && aot == NULL) {
+                aot = aot_compile(decoded);
+                owns_aot = true;
+                if (aot == NULL) {
+                    LOG_WARN("[!] AOT module unavailable, falling back to switch engine");
+                }
+            }
+        }
+
+        resume_at = 0;
+        return true;
+    }
+
+    int execute_slice(int idx) {
+        if (profile != NULL) {
+            return execute_profiled(idx);
+        }
+        if (engine == ENGINE_INPLACE) {
+            return execute_inplace(idx);
+        }
+
+        // the unchecked engines rely on SP being what the verifier worked out
+        // for 'idx', a host that moved it since gets the checked engine for this slice
+        if (decoded->verified && (int)registers[SP] != decoded->stack_depths[idx]) {
+            LOG_DEBUG("[D] SP does not match the verified stack depth, running checked");
+            return execute_switch<false>(idx);
+        }
+
+        const bool verified = decoded->verified;
+        switch (engine) {
+#if CEMU_HAS_COMPUTED_GOTO
+            case ENGINE_THREADED: return verified ? execute_threaded<true>(idx) : execute_threaded<false>(idx);
+#endif
+            case ENGINE_JIT: return execute_jit(idx);
+            case ENGINE_AOT: return execute_aot(idx);
+            case ENGINE_BLOCK: {
+                if (decoded->blocks != NULL) {
+                    return verified ? execute_blocks<true>(idx) : execute_blocks<false>(idx);
+                }
+                break;
+            }
+            // switch, and anything this build can't run natively, uses the plain interpreter
+            default: break;
+        }
+        return verified ? execute_switch<true>(idx) : execute_switch<false>(idx);
+    }
+
+    // runs the current program for about 'instructions' more instructions,
+    // starting a new run if the last one halted. the budget is only looked at
+    // when a jump is taken, the end of a basic block, so a slice can run over
+    // by one block. a program without jumps always runs to the end.
+    cpu_status_t run_for(unsigned int instructions) {
+        if (resume_at < 0 && !begin_run())
+            return CPU_HALTED;
+
+        slice_start = this->info->total_run_cycles;
+        slice_budget = instructions;
+        const int idx = execute_slice(resume_at);
+        slice_budget = UINT_MAX;
+        materialize_flags();
+
+        const unsigned int base = this->info->program_counter_lower_bound;
+        if (idx == CPU_YIELD) {
+            registers[PC] = base + (runs_inplace() ? resume_at : decoded->instructions[resume_at].offset);
+            return CPU_YIELDED;
+        }
+
+        resume_at = -1;
+        io.flush();
+        if (idx == CPU_EXIT) {
+            registers[PC] = this->info->program_counter_higher_bound;
+            LOG_MSG("[+] Program exited with code " << (int)registers[R0]);
+        } else {
+            registers[PC] = base + (runs_inplace() ? idx : decoded->instructions[decoded->length].offset);
+        }
+        LOG_MSG("[+] Program execution complete: " << this->info->total_run_cycles << " total cycles");
+        if (profile != NULL) {
+            print_profile(profile, decoded);
+        }
+        return CPU_HALTED;
+    }
+
+    // keeps running slices until the program halts or 'deadline' passes, the
+    // clock is read once every CPU_TIME_SLICE instructions
+    cpu_status_t run_until(std::chrono::steady_clock::time_point deadline) {
+        cpu_status_t status = CPU_YIELDED;
+        while (status == CPU_YIELDED && std::chrono::steady_clock::now() < deadline) {
+            status = run_for(CPU_TIME_SLICE);
+        }
+        return status;
+    }
+
+    // runs the program to the end, however long that takes
+    void execute() {
+        while (run_for(UINT_MAX) == CPU_YIELDED) {}
+    }
+};
+
+#endif // __CPU_H__
\ No newline at end of file
@@ -0,0 +1,266 @@
+#include "decoder.h"
+
+static constexpr size_t DECODED_HEADER_SIZE = sizeof(unsigned char) + sizeof(int);   // opcode + operand count
+
+// walks the bytecode once without storing anything, returns the number of
+// whole instructions. a truncated tail (garbage length, missing operands) is dropped.
+static int count_instructions(const unsigned char* bytecode, size_t length, size_t* used) {
+    size_t position = 0;
+    int count = 0;
+
+    while (position + DECODED_HEADER_SIZE <= length) {
+        int operand_count;
+        memcpy(&operand_count, &bytecode[position + 1], sizeof(int));
+
+        if (operand_count < 0 ||
+            position + DECODED_HEADER_SIZE + (size_t)operand_count * DECODED_OPERAND_SIZE > length) {
+            LOG_ERROR("[-] decode_bytecode() found a truncated instruction at offset " << position);
+            break;
+        }
+
+        position += DECODED_HEADER_SIZE + (size_t)operand_count * DECODED_OPERAND_SIZE;
+        count++;
+    }
+
+    (*used) = position;
+    return count;
+}
+
+// ZF or SF as a register operand (read or written, a write has to land after
+// the pending compare), or an interrupt handler that can see every register
+static bool reads_flags(const op_decoded_t* inst) {
+    if (inst->type == INT)
+        return true;
+
+    const int count = std::min(register_operands(inst->type), (int)inst->length);
+    for (int i = 0; i < count; ++i) {
+        if (inst->operands[i] == ZF || inst->operands[i] == SF)
+            return true;
+    }
+    return false;
+}
+
+// a compare the engines actually run, a malformed one leaves the flags alone
+static bool sets_flags(const op_decoded_t* inst) {
+    if (inst->type != CMP && inst->type != CMPJE && inst->type != CMPJNE)
+        return false;
+
+    return inst->length == (inst->type == CMP ? 2 : 3) &&
+           (unsigned int)inst->operands[0] < (unsigned int)REGISTER_SIZE &&
+           (unsigned int)inst->operands[1] < (unsigned int)REGISTER_SIZE;
+}
+
+// a JMP only goes to its target, a conditional jump either way
+static bool live_out(const op_decoded_t* inst, const bool* live) {
+    if (inst->target < 0)
+        return live[inst->next];
+    if (inst->type == JMP)
+        return live[inst->target];
+    return live[inst->next] || live[inst->target];
+}
+
+// backwards liveness of the flags, iterated until it settles (loops make
+// it a fixed point). live[i]: the flags held when instruction i starts can
+// still be read by name
+static void mark_eager_flags(op_decoded_program_t* program) {
+    const int length = program->length;
+    bool* live = (bool*)calloc(length + 1, sizeof(bool));
+    if (live == NULL) {
+        // every compare writes its flags then, which is always right
+        for (int i = 0; i < length; ++i) {
+            program->instructions[i].eager_flags = sets_flags(&program->instructions[i]);
+        }
+        return;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = length - 1; i >= 0; --i) {
+            const op_decoded_t* inst = &program->instructions[i];
+            const bool out = live_out(inst, live);
+            const bool in = reads_flags(inst) || (!sets_flags(inst) && out);
+            if (in != live[i]) {
+                live[i] = in;
+                changed = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < length; ++i) {
+        op_decoded_t* inst = &program->instructions[i];
+        inst->eager_flags = sets_flags(inst) && live_out(inst, live);
+    }
+    free(live);
+}
+
+op_decoded_program_t* decode_bytecode(const unsigned char* bytecode, size_t length) {
+    op_decoded_program_t* program = (op_decoded_program_t*)malloc(sizeof(op_decoded_program_t));
+    if (program == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for op_decoded_program_t");
+        return NULL;
+    }
+
+    size_t used = 0;
+    program->length = count_instructions(bytecode, length, &used);
+    program->bytecode_length = used;
+    program->verified = false;
+    program->stack_depths = NULL;
+    program->blocks = NULL;
+    program->block_count = 0;
+    program->block_at = NULL;
+    program->instructions = (op_decoded_t*)malloc(sizeof(op_decoded_t) * (program->length + 1));
+
+    // maps a byte offset to the instruction starting there, -1 for offsets that
+    // land in the middle of an instruction. only needed while resolving jumps.
+    int* offset_to_index = (int*)malloc(sizeof(int) * (used + 1));
+    if (program->instructions == NULL || offset_to_index == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for decoded instructions");
+        free(program->instructions);
+        free(offset_to_index);
+        free(program);
+        return NULL;
+    }
+
+    for (size_t i = 0; i <= used; ++i) {
+        offset_to_index[i] = -1;
+    }
+    offset_to_index[used] = program->length;
+
+    size_t position = 0;
+    for (int i = 0; i < program->length; ++i) {
+        op_decoded_t* inst = &program->instructions[i];
+        memset(inst, 0, sizeof(op_decoded_t));
+
+        int operand_count;
+        inst->type = bytecode[position];
+        memcpy(&operand_count, &bytecode[position + 1], sizeof(int));
+        inst->offset = (int)position;
+        offset_to_index[position] = i;
+
+        const size_t operands_position = position + DECODED_HEADER_SIZE;
+        const int stored = std::min(operand_count, MAX_DECODED_OPERANDS);
+        memcpy(inst->operands, &bytecode[operands_position], (size_t)stored * DECODED_OPERAND_SIZE);
+
+        inst->length = (unsigned char)std::min(operand_count, 0xFF);
+        inst->next = i + 1;
+        inst->target = -1;
+
+        position = operands_position + (size_t)operand_count * DECODED_OPERAND_SIZE;
+    }
+
+    // second pass, now that every instruction boundary is known
+    for (int i = 0; i < program->length; ++i) {
+        op_decoded_t* inst = &program->instructions[i];
+        const int operand = jump_operand(inst->type);
+        if (operand < 0 || inst->length != operand + 1)
+            continue;
+
+        const int jump_offset = inst->operands[operand];
+        if (jump_offset >= 0 && (size_t)jump_offset <= used) {
+            inst->target = offset_to_index[jump_offset];
+        }
+    }
+
+    // the entry past the end only carries the final offset, so the
+    // interpreter can always look up where the program stops.
+    memset(&program->instructions[program->length], 0, sizeof(op_decoded_t));
+    program->instructions[program->length].offset = (int)used;
+    program->instructions[program->length].target = -1;
+
+    free(offset_to_index);
+    mark_eager_flags(program);
+    build_blocks(program);
+    return program;
+}
+
+void free_decoded_program(op_decoded_program_t* program) {
+    if (program == NULL)
+        return;
+
+    free(program->instructions);
+    free(program->stack_depths);
+    free_blocks(program);
+    free(program);
+}
+
+// the last instruction of a block
+static bool ends_block(const op_decoded_t* inst) {
+    return jump_operand(inst->type) >= 0 || inst->type == INT;
+}
+
+bool build_blocks(op_decoded_program_t* program) {
+    free_blocks(program);
+
+    const int length = program->length;
+    int* block_at = (int*)malloc(sizeof(int) * (length + 1));
+    if (block_at == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for basic blocks");
+        return false;
+    }
+
+    // mark the leaders first, every one of them gets a block
+    for (int i = 0; i <= length; ++i) {
+        block_at[i] = -1;
+    }
+    if (length > 0) {
+        block_at[0] = 0;
+    }
+    for (int i = 0; i < length; ++i) {
+        const op_decoded_t* inst = &program->instructions[i];
+        if (inst->target >= 0 && inst->target < length) {
+            block_at[inst->target] = 0;
+        }
+        if (ends_block(inst) && i + 1 < length) {
+            block_at[i + 1] = 0;
+        }
+    }
+
+    int count = 0;
+    for (int i = 0; i < length; ++i) {
+        if (block_at[i] >= 0) {
+            block_at[i] = count++;
+        }
+    }
+    block_at[length] = count;
+
+    op_block_t* blocks = (op_block_t*)malloc(sizeof(op_block_t) * (count + 1));
+    if (blocks == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for basic blocks");
+        free(block_at);
+        return false;
+    }
+
+    for (int i = 0, b = 0; i < length; ++i) {
+        if (block_at[i] < 0)
+            continue;
+
+        int last = i;
+        while (last + 1 < length && block_at[last + 1] < 0) {
+            last++;
+        }
+
+        const op_decoded_t* inst = &program->instructions[last];
+        blocks[b].first = i;
+        blocks[b].count = last - i + 1;
+        blocks[b].fallthrough = block_at[inst->next];
+        blocks[b].taken = inst->target >= 0 ? block_at[inst->target] : -1;
+        b++;
+    }
+
+    // the end of the program, never executed
+    blocks[count] = { length, 0, count, -1 };
+
+    program->blocks = blocks;
+    program->block_count = count;
+    program->block_at = block_at;
+    return true;
+}
+
+void free_blocks(op_decoded_program_t* program) {
+    free(program->blocks);
+    free(program->block_at);
+    program->blocks = NULL;
+    program->block_count = 0;
+    program->block_at = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef __DECODER_H__
+#define __DECODER_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "opcodes.h"
+#include "machine.h"
+
+static constexpr int MAX_DECODED_OPERANDS = 3;
+static constexpr int DECODED_OPERAND_SIZE = sizeof(int);   // every operand in the bytecode is an int32
+
+// a single instruction decoded out of the bytecode. fixed size so the
+// interpreter can walk an array of these instead of going back through
+// binaryp_t (read_uint8/read_int32 + bounds checks) on every step.
+typedef struct op_decoded_t {
+  unsigned char type;
+  unsigned char length;
+  bool eager_flags;                         // CMP whose ZF/SF may be read by name before the next compare, see below
+  int operands[MAX_DECODED_OPERANDS];
+  int offset;                               // byte offset of the instruction in the bytecode
+  int next;                                 // index of the instruction that follows this one
+  int target;                               // resolved jump target index (-1 if invalid / not a jump)
+};
+
+// a basic block: straight-line instructions, only the last one can jump or
+// end the run (a jump, or an INT). blocks start at instruction 0, at every
+// jump target and after every block end. the successors are linked by block
+// index, so the block engine goes from one block to the next without looking
+// anything up. 'block_count' (one past the last block) stands for the end of the program.
+typedef struct op_block_t {
+  int first;                                // instruction index
+  int count;                                // instructions, the last one ends the block
+  int fallthrough;                          // block after the last instruction
+  int taken;                                // block at the jump target, -1 if it doesn't jump
+};
+
+typedef struct op_decoded_program_t {
+  int length;
+  size_t bytecode_length;
+  op_decoded_t* instructions;
+  bool verified;                            // verify_program() accepted it, see verifier.h
+  int* stack_depths;                        // SP before every instruction (length + 1), only when verified
+  op_block_t* blocks;                       // see build_blocks(), NULL without them
+  int block_count;
+  int* block_at;                            // block starting at every instruction (length + 1), -1 mid-block
+};
+
+// decodes the bytecode written by cpu_t::initialize_bytecode() once.
+// jump operands (byte offsets into the bytecode) are resolved into
+// instruction indices, a jump to the very end resolves to 'length'.
+//
+// a compare only records its operands and JE/JNE test those, ZF and SF are
+// written when something else could see them. the decoder works out which
+// compares have their flags read by name (an instruction with ZF or SF as a
+// register operand, or an interrupt handler) before the next compare replaces
+// them, and marks those 'eager_flags' so they write ZF/SF straight away. for
+// the rest the engines hold the flags back until the slice ends.
+op_decoded_program_t* decode_bytecode(const unsigned char* bytecode, size_t length);
+void free_decoded_program(op_decoded_program_t* program);
+
+// splits a decoded program into basic blocks, done by decode_bytecode().
+// false (and no blocks) when out of memory, the block engine then runs the switch engine
+bool build_blocks(op_decoded_program_t* program);
+void free_blocks(op_decoded_program_t* program);
+
+#endif // __DECODER_H__
\ No newline at end of file
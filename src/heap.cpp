@@ -0,0 +1,155 @@
+#include "heap.h"
+
+static int size_class(int count) {
+    return 31 - __builtin_clz((unsigned int)count);
+}
+
+size_t heap_t::tables_size(int size) {
+    return sizeof(unsigned int) * 4 * (size_t)(size / HEAP_GRANULE);
+}
+
+// 'tables' has to be tables_size(size) zeroed bytes
+void heap_t::init(int base, int size, unsigned int* tables) {
+    this->base = base;
+    this->granules = size / HEAP_GRANULE;
+    this->class_bitmap = 0;
+
+    for (int i = 0; i < HEAP_CLASSES; ++i) {
+        free_heads[i] = HEAP_NIL;
+    }
+    attach(tables);
+
+    // the whole heap starts out as one free block
+    if (granules > 0) {
+        insert_free(0, granules);
+    }
+}
+
+void heap_t::attach(unsigned int* tables) {
+    head_tags = tables;
+    tail_tags = tables + granules;
+    next_free = tables + granules * 2;
+    prev_free = tables + granules * 3;
+}
+
+void heap_t::insert_free(int granule, int count) {
+    const int c = size_class(count);
+    const unsigned int tag = (unsigned int)count | HEAP_FREE_BIT;
+    head_tags[granule] = tag;
+    tail_tags[granule + count - 1] = tag;
+
+    next_free[granule] = free_heads[c];
+    prev_free[granule] = HEAP_NIL;
+    if (free_heads[c] != HEAP_NIL) {
+        prev_free[free_heads[c]] = (unsigned int)granule;
+    }
+    free_heads[c] = (unsigned int)granule;
+    class_bitmap |= 1u << c;
+}
+
+void heap_t::remove_free(int granule, int count) {
+    const int c = size_class(count);
+    const unsigned int next = next_free[granule];
+    const unsigned int prev = prev_free[granule];
+
+    if (prev != HEAP_NIL) next_free[prev] = next;
+    else free_heads[c] = next;
+    if (next != HEAP_NIL) prev_free[next] = prev;
+
+    if (free_heads[c] == HEAP_NIL) {
+        class_bitmap &= ~(1u << c);
+    }
+}
+
+int heap_t::allocate(int size) {
+    // anything bigger than the whole heap is turned away before the rounding can overflow
+    if (size < 0 || size > granules * HEAP_GRANULE) {
+        return -1;
+    }
+    const int count = std::max(1, (size + HEAP_GRANULE - 1) / HEAP_GRANULE);
+
+    // every block in a class above floor(log2(count)) is big enough, so that
+    // search is a single bit scan. blocks in the floor class may or may not fit.
+    int c = size_class(count);
+    unsigned int granule = HEAP_NIL;
+    const unsigned int fits = c + 1 < HEAP_CLASSES ? class_bitmap & (~0u << (c + 1)) : 0;
+
+    if ((1 << c) == count && (class_bitmap & (1u << c))) {
+        granule = free_heads[c];
+    } else if (fits != 0) {
+        granule = free_heads[__builtin_ctz(fits)];
+    } else {
+        for (unsigned int g = free_heads[c]; g != HEAP_NIL; g = next_free[g]) {
+            if ((int)(head_tags[g] & ~HEAP_FREE_BIT) >= count) {
+                granule = g;
+                break;
+            }
+        }
+    }
+
+    if (granule == HEAP_NIL) {
+        return -1;
+    }
+
+    const int block = head_tags[granule] & ~HEAP_FREE_BIT;
+    remove_free(granule, block);
+
+    if (block > count) {
+        insert_free(granule + count, block - count);
+    }
+
+    head_tags[granule] = (unsigned int)count;
+    tail_tags[granule + count - 1] = (unsigned int)count;
+    return base + granule * HEAP_GRANULE;
+}
+
+bool heap_t::release(int offset) {
+    const int relative = offset - base;
+    if (relative < 0 || relative % HEAP_GRANULE != 0 || relative / HEAP_GRANULE >= granules) {
+        return false;
+    }
+
+    int granule = relative / HEAP_GRANULE;
+    const unsigned int tag = head_tags[granule];
+    if (tag == 0 || (tag & HEAP_FREE_BIT)) {
+        return false;                       // not the start of a block, or a double free
+    }
+    int count = (int)tag;
+
+    // merge with the right neighbour, its tags are no longer block edges
+    const int right = granule + count;
+    if (right < granules && (head_tags[right] & HEAP_FREE_BIT)) {
+        const int right_count = head_tags[right] & ~HEAP_FREE_BIT;
+        remove_free(right, right_count);
+        head_tags[right] = 0;
+        tail_tags[granule + count - 1] = 0;
+        count += right_count;
+    }
+
+    // and with the left one, found through its tail tag
+    if (granule > 0 && (tail_tags[granule - 1] & HEAP_FREE_BIT)) {
+        const int left_count = tail_tags[granule - 1] & ~HEAP_FREE_BIT;
+        const int left = granule - left_count;
+        remove_free(left, left_count);
+        tail_tags[granule - 1] = 0;
+        head_tags[granule] = 0;
+        granule = left;
+        count += left_count;
+    }
+
+    insert_free(granule, count);
+    return true;
+}
+
+int heap_t::size_of(int offset) {
+    const int relative = offset - base;
+    if (relative < 0 || relative % HEAP_GRANULE != 0 || relative / HEAP_GRANULE >= granules) {
+        return -1;
+    }
+
+    const unsigned int tag = head_tags[relative / HEAP_GRANULE];
+    if (tag == 0 || (tag & HEAP_FREE_BIT)) {
+        return -1;
+    }
+    return (int)tag * HEAP_GRANULE;
+}
\ No newline at end of file
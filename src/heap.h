@@ -0,0 +1,43 @@
+#ifndef __HEAP_H__
+#define __HEAP_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "machine.h"
+
+static constexpr int HEAP_GRANULE = 8;                                          // allocation unit in bytes
+static constexpr int HEAP_CLASSES = 32;                                         // size class = floor(log2(granules))
+static constexpr unsigned int HEAP_NIL = 0xFFFFFFFF;
+static constexpr unsigned int HEAP_FREE_BIT = 0x80000000;
+
+// guest heap over cpu_t::memory. every block carries a boundary tag (size in
+// granules + free bit) on its first and last granule, kept in side tables
+// instead of in guest memory, so a free can coalesce with both neighbours in
+// O(1). free blocks sit in segregated lists by size class, a bitmap of
+// non-empty classes finds a fitting list with one bit scan.
+//
+// the tables live in the cpu's page mapping right after guest memory (see
+// pages.h). they start out zeroed, which reads as "no block edge here", so
+// init() never touches them and only the pages around block edges get backed.
+typedef struct heap_t {
+  int base;                                 // offset of the heap in guest memory
+  int granules;
+  unsigned int class_bitmap;
+  unsigned int free_heads[HEAP_CLASSES];
+  unsigned int* head_tags;                  // 'granules' entries each, see tables_size()
+  unsigned int* tail_tags;
+  unsigned int* next_free;
+  unsigned int* prev_free;
+
+  static size_t tables_size(int size);      // bytes of side tables for a heap of 'size' bytes
+  void init(int base, int size, unsigned int* tables);
+  void attach(unsigned int* tables);        // points the tables somewhere else, e.g. into a forked cpu
+  int allocate(int size);                   // returns the guest memory offset, -1 if out of memory
+  bool release(int offset);
+  int size_of(int offset);                  // usable size of an allocated block, -1 if not a block
+
+  void insert_free(int granule, int count);
+  void remove_free(int granule, int count);
+};
+
+#endif // __HEAP_H__
\ No newline at end of file
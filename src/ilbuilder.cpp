@@ -1,29 +1,112 @@
 #include "ilbuilder.h"
 
+static constexpr int PROGRAM_INITIAL_CAPACITY = 64;
+static constexpr size_t PROGRAM_INITIAL_OPERANDS_CAPACITY = 256;
+
+size_t op_program_t::operands_size(int idx) const {
+    return (size_t)(offsets[idx + 1] - offsets[idx]);
+}
+
+const unsigned char* op_program_t::operands_of(int idx) const {
+    return &operands[offsets[idx]];
+}
+
+int op_program_t::operand_int(int idx, int operand) const {
+    int value;
+    memcpy(&value, &operands[offsets[idx] + operand * sizeof(int)], sizeof(int));
+    return value;
+}
+
 op_program_t* create_program() {
     op_program_t* ptr = (op_program_t*)malloc(sizeof(op_program_t));
     {
         ptr->length = 0;
-        ptr->instructions = NULL;
+        ptr->capacity = 0;
+        ptr->types = NULL;
+        ptr->lengths = NULL;
+        ptr->offsets = (int*)malloc(sizeof(int));
+        ptr->offsets[0] = 0;
+        ptr->operands = NULL;
+        ptr->operands_length = 0;
+        ptr->operands_capacity = 0;
     }
     return ptr;
 }
 
-void add_instruction(op_program_t* program, op_type_t type, int length, size_t* sizes, void* operands) {
-    program->instructions = (op_inst_t**)realloc(
-        program->instructions, 
-        sizeof(op_inst_t*) * (program->length + 1)
-    );
+void free_program(op_program_t* program) {
+    if (program == NULL)
+        return;
 
-    op_inst_t* instruction = (op_inst_t*)malloc(sizeof(op_inst_t));
-    {
-        instruction->index = program->length;
-        instruction->type = type;
-        instruction->length = length;
-        instruction->sizes = std::move(sizes);
-        instruction->operands = std::move(operands);
+    free(program->types);
+    free(program->lengths);
+    free(program->offsets);
+    free(program->operands);
+    free(program);
+}
+
+static bool grow_instructions(op_program_t* program) {
+    int capacity = program->capacity == 0 ? PROGRAM_INITIAL_CAPACITY : program->capacity * 2;
+    unsigned char* types = (unsigned char*)realloc(program->types, sizeof(unsigned char) * capacity);
+    if (types != NULL) program->types = types;
+    int* lengths = (int*)realloc(program->lengths, sizeof(int) * capacity);
+    if (lengths != NULL) program->lengths = lengths;
+    int* offsets = (int*)realloc(program->offsets, sizeof(int) * (capacity + 1));
+    if (offsets != NULL) program->offsets = offsets;
+
+    if (types == NULL || lengths == NULL || offsets == NULL) {
+        LOG_ERROR("[-] Failed to grow program to " << capacity << " instructions");
+        return false;
+    }
+
+    program->capacity = capacity;
+    return true;
+}
+
+static bool grow_operands(op_program_t* program, size_t needed) {
+    size_t capacity = std::max(program->operands_capacity, PROGRAM_INITIAL_OPERANDS_CAPACITY);
+    while (capacity < needed) {
+        capacity *= 2;
     }
 
-    program->instructions[program->length] = instruction;
+    unsigned char* operands = (unsigned char*)realloc(program->operands, capacity);
+    if (operands == NULL) {
+        LOG_ERROR("[-] Failed to grow operand pool to " << capacity << " bytes");
+        return false;
+    }
+
+    program->operands = operands;
+    program->operands_capacity = capacity;
+    return true;
+}
+
+bool append_instruction(op_program_t* program, unsigned char type, int length, const void* operands, size_t operands_size) {
+    // amortized growth instead of a realloc per instruction
+    if (program->length == program->capacity && !grow_instructions(program)) {
+        return false;
+    }
+
+    if (program->operands_length + operands_size > program->operands_capacity &&
+        !grow_operands(program, program->operands_length + operands_size)) {
+        return false;
+    }
+
+    if (operands_size > 0) {
+        memcpy(&program->operands[program->operands_length], operands, operands_size);
+    }
+    program->operands_length += operands_size;
+
+    program->types[program->length] = type;
+    program->lengths[program->length] = length;
+    program->offsets[program->length + 1] = (int)program->operands_length;
     program->length++;
+    return true;
+}
+
+bool add_instruction(op_program_t* program, op_type_t type, int length, size_t* sizes, void* operands) {
+    size_t operands_size = 0;
+    for (int i = 0; i < length; ++i) {
+        operands_size += sizes[i];
+    }
+
+    return append_instruction(program, type, length, operands, operands_size);
 }
@@ -5,12 +5,33 @@
 #include "log.h"
 #include "opcodes.h"
 
+// structure-of-arrays program. instruction 'i' is types[i] with lengths[i]
+// operands, whose bytes sit in the shared 'operands' pool between
+// offsets[i] and offsets[i + 1]. passes over a program are linear scans
+// of these arrays, and free_program() releases everything at once.
 typedef struct op_program_t {
   int length;
-  op_inst_t** instructions;
+  int capacity;
+  unsigned char* types;
+  int* lengths;                             // operand count of every instruction
+  int* offsets;                             // byte offset into 'operands' (length + 1 entries)
+  unsigned char* operands;
+  size_t operands_length;
+  size_t operands_capacity;
+
+  size_t operands_size(int idx) const;
+  const unsigned char* operands_of(int idx) const;
+  int operand_int(int idx, int operand) const;     // reads operand 'operand' of 'idx' as an int32
 };
 
 op_program_t* create_program();
-void add_instruction(op_program_t* program, op_type_t type, int length, size_t* sizes, void* operands);
+void free_program(op_program_t* program);
+
+// 'sizes' and 'operands' are copied into the program, the caller
+// keeps ownership of what it passed in. false (logged) if the program
+// couldn't grow, it's left without the instruction
+bool add_instruction(op_program_t* program, op_type_t type, int length, size_t* sizes, void* operands);
+// same, for callers that already have the operand bytes laid out back to back
+bool append_instruction(op_program_t* program, unsigned char type, int length, const void* operands, size_t operands_size);
 
 #endif // __ILBUILDER_H__
\ No newline at end of file
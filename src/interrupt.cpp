@@ -1,15 +1,184 @@
 #include "interrupt.h"
-#include "log.h"
 
-void interrupt_handler(int interrupt_id) {
-    switch (interrupt_id) {
-        case 0xAA01: {
-            LOG_MSG("[+] Interrupt 0xAA01");
-            break;
+#include <chrono>
+
+#pragma region Host I/O
+
+void host_io_t::write(int stream, const void* data, size_t size) {
+    if (stream != 1) {
+        flush();
+        fwrite(data, 1, size, stderr);
+        return;
+    }
+
+    if (buffer == NULL) {
+        buffer = (char*)malloc(HOST_IO_BUFFER_SIZE);
+        if (buffer == NULL) {
+            LOG_ERROR("[-] Failed to allocate memory for the host I/O buffer");
+            fwrite(data, 1, size, out != NULL ? out : stdout);
+            return;
         }
-        default: {
-            LOG_MSG("[!] Unknown interrupt: 0x" << std::hex << interrupt_id);
-            break;
+    }
+
+    // too big to be worth buffering, it goes out in the same write as what's pending
+    if (length + size > HOST_IO_BUFFER_SIZE) {
+        flush();
+        if (size >= HOST_IO_BUFFER_SIZE) {
+            fwrite(data, 1, size, out != NULL ? out : stdout);
+            return;
         }
     }
-}
\ No newline at end of file
+
+    memcpy(buffer + length, data, size);
+    length += size;
+}
+
+// up to 'size' bytes, or up to and including the next newline
+size_t host_io_t::read(void* data, size_t size) {
+    FILE* stream = in != NULL ? in : stdin;
+    char* bytes = (char*)data;
+
+    // a prompt has to be out before the guest waits on the answer
+    flush();
+
+    size_t count = 0;
+    while (count < size) {
+        const int c = getc(stream);
+        if (c == EOF)
+            break;
+
+        bytes[count++] = (char)c;
+        if (c == '\n')
+            break;
+    }
+    return count;
+}
+
+void host_io_t::flush() {
+    if (length == 0)
+        return;
+
+    FILE* stream = out != NULL ? out : stdout;
+    fwrite(buffer, 1, length, stream);
+    fflush(stream);
+    length = 0;
+}
+
+void host_io_t::release() {
+    flush();
+    free(buffer);
+    buffer = NULL;
+}
+
+#pragma endregion
+
+#pragma region Services
+
+// [address, address + size) inside guest memory
+static bool guest_range(const interrupt_context_t* context, unsigned int address, unsigned int size) {
+    return address <= context->memory_size && size <= context->memory_size - address;
+}
+
+static interrupt_result_t service_exit(interrupt_context_t*) {
+    return INTERRUPT_HALT;
+}
+
+static interrupt_result_t service_ping(interrupt_context_t*) {
+    LOG_MSG("[+] Interrupt 0xAA01");
+    return INTERRUPT_CONTINUE;
+}
+
+static interrupt_result_t service_write(interrupt_context_t* context) {
+    unsigned int* registers = context->registers;
+    const unsigned int stream = registers[R0];
+    if ((stream != 1 && stream != 2) || !guest_range(context, registers[R1], registers[R2])) {
+        registers[R0] = (unsigned int)-1;
+        return INTERRUPT_CONTINUE;
+    }
+
+    context->io->write(stream, &context->memory[registers[R1]], registers[R2]);
+    registers[R0] = registers[R2];
+    return INTERRUPT_CONTINUE;
+}
+
+static interrupt_result_t service_read(interrupt_context_t* context) {
+    unsigned int* registers = context->registers;
+    if (registers[R0] != 0 || !guest_range(context, registers[R1], registers[R2])) {
+        registers[R0] = (unsigned int)-1;
+        return INTERRUPT_CONTINUE;
+    }
+
+    registers[R0] = (unsigned int)context->io->read(&context->memory[registers[R1]], registers[R2]);
+    return INTERRUPT_CONTINUE;
+}
+
+static interrupt_result_t service_time(interrupt_context_t* context) {
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(now);
+    context->registers[R0] = (unsigned int)seconds.count();
+    context->registers[R1] = (unsigned int)std::chrono::duration_cast<std::chrono::nanoseconds>(now - seconds).count();
+    return INTERRUPT_CONTINUE;
+}
+
+static interrupt_result_t service_putc(interrupt_context_t* context) {
+    const char c = (char)context->registers[R0];
+    context->io->write(1, &c, 1);
+    return INTERRUPT_CONTINUE;
+}
+
+#pragma endregion
+
+static interrupt_table_t make_default_table() {
+    interrupt_table_t table = {};
+    register_interrupt(&table, INTERRUPT_EXIT, service_exit);
+    register_interrupt(&table, INTERRUPT_PING, service_ping);
+    register_interrupt(&table, INTERRUPT_WRITE, service_write);
+    register_interrupt(&table, INTERRUPT_READ, service_read);
+    register_interrupt(&table, INTERRUPT_TIME, service_time);
+    register_interrupt(&table, INTERRUPT_PUTC, service_putc);
+    return table;
+}
+
+const interrupt_table_t* default_interrupt_table() {
+    static const interrupt_table_t table = make_default_table();
+    return &table;
+}
+
+interrupt_table_t* create_interrupt_table(bool services) {
+    auto table = (interrupt_table_t*)calloc(1, sizeof(interrupt_table_t));
+    if (table == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for interrupt_table_t");
+        return NULL;
+    }
+
+    if (services) {
+        (*table) = *default_interrupt_table();
+    }
+    return table;
+}
+
+void free_interrupt_table(interrupt_table_t* table) {
+    free(table);
+}
+
+bool register_interrupt(interrupt_table_t* table, int interrupt_id, interrupt_handler_t handler, void* data) {
+    if ((interrupt_id & ~(INTERRUPT_TABLE_SIZE - 1)) != INTERRUPT_BASE) {
+        LOG_WARN("[!] Interrupt id 0x" << std::hex << interrupt_id << std::dec << " is outside 0xAA00..0xAAFF");
+        return false;
+    }
+
+    table->handlers[interrupt_id & (INTERRUPT_TABLE_SIZE - 1)] = handler;
+    table->data[interrupt_id & (INTERRUPT_TABLE_SIZE - 1)] = data;
+    return true;
+}
+
+interrupt_result_t dispatch_interrupt(const interrupt_table_t* table, int interrupt_id, interrupt_context_t* context) {
+    const int slot = interrupt_id & (INTERRUPT_TABLE_SIZE - 1);
+    if ((interrupt_id & ~(INTERRUPT_TABLE_SIZE - 1)) != INTERRUPT_BASE || table->handlers[slot] == NULL) {
+        LOG_WARN("[!] Unknown interrupt: 0x" << std::hex << interrupt_id << std::dec);
+        return INTERRUPT_CONTINUE;
+    }
+
+    context->data = table->data[slot];
+    return table->handlers[slot](context);
+}
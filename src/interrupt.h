@@ -2,8 +2,76 @@
 #define __INTERRUPT_H__
 
 #include "stdafx.h"
+#include "log.h"
+#include "machine.h"
 
-// interrupt id = 0xAA{ID:X2} (0xAA01)
-void interrupt_handler(const int interrupt_id);
+// interrupt id = 0xAA{ID:X2} (0xAA01), the low byte indexes the dispatch
+// table so raising one is a single load and an indirect call
+static constexpr int INTERRUPT_BASE = 0xAA00;
+static constexpr int INTERRUPT_TABLE_SIZE = 0x100;
 
-#endif // __INTERRUPT_H__
\ No newline at end of file
+// the standard host services, arguments and results in registers
+enum interrupt_service_t : int {
+    INTERRUPT_EXIT      = 0xAA00,           // ends the run, R0 = exit code
+    INTERRUPT_PING      = 0xAA01,           // logs "Interrupt 0xAA01", the original (and only) interrupt
+    INTERRUPT_WRITE     = 0xAA02,           // R0 = stream (1 out, 2 err), R1 = address, R2 = length -> R0 = bytes written
+    INTERRUPT_READ      = 0xAA03,           // R0 = stream (0 in), R1 = address, R2 = length -> R0 = bytes read, stops after a newline
+    INTERRUPT_TIME      = 0xAA04,           // -> R0 = unix seconds (low 32 bits), R1 = nanoseconds
+    INTERRUPT_PUTC      = 0xAA05,           // R0 = byte written to stream 1
+};
+
+// guest output on stream 1 collects here and goes to 'out' in one write
+// once HOST_IO_BUFFER_SIZE bytes are pending, before a read, and when the
+// run ends, so a guest printing a byte at a time doesn't cost a write per byte.
+// stream 2 is written straight through (after the pending output).
+static constexpr size_t HOST_IO_BUFFER_SIZE = 8 * 1024;
+
+typedef struct host_io_t {
+  FILE* in;                                 // stream 0, stdin when NULL
+  FILE* out;                                // stream 1, stdout when NULL
+  char* buffer;                             // HOST_IO_BUFFER_SIZE bytes, allocated on the first write
+  size_t length;
+
+  void write(int stream, const void* data, size_t size);
+  size_t read(void* data, size_t size);
+  void flush();
+  void release();                           // flushes and frees the buffer, 'in'/'out' are left open
+};
+
+// what a handler sees of the cpu that raised it. handlers may change any
+// register but SP and PC, the engines keep those to themselves and put
+// them back (with a warning) if a handler moved them
+typedef struct interrupt_context_t {
+  unsigned int* registers;
+  unsigned char* memory;
+  unsigned int memory_size;                 // guest memory only, the heap tables after it are off limits
+  host_io_t* io;
+  void* data;                               // what the handler was registered with
+};
+
+enum interrupt_result_t : unsigned char {
+    INTERRUPT_CONTINUE  = 0x00,
+    INTERRUPT_HALT      = 0x01,             // ends the run after this instruction
+};
+
+typedef interrupt_result_t (*interrupt_handler_t)(interrupt_context_t* context);
+
+typedef struct interrupt_table_t {
+  interrupt_handler_t handlers[INTERRUPT_TABLE_SIZE];
+  void* data[INTERRUPT_TABLE_SIZE];
+};
+
+// the table every cpu uses unless it's given its own, holds the standard services
+const interrupt_table_t* default_interrupt_table();
+
+// an empty table, or a copy of the default one with 'services'
+interrupt_table_t* create_interrupt_table(bool services);
+void free_interrupt_table(interrupt_table_t* table);
+
+// false if 'interrupt_id' isn't 0xAA00..0xAAFF. a NULL handler unregisters it
+bool register_interrupt(interrupt_table_t* table, int interrupt_id, interrupt_handler_t handler, void* data = NULL);
+
+// unknown ids are logged and ignored
+interrupt_result_t dispatch_interrupt(const interrupt_table_t* table, int interrupt_id, interrupt_context_t* context);
+
+#endif // __INTERRUPT_H__
@@ -0,0 +1,481 @@
+#include "jit.h"
+
+#if CEMU_HAS_JIT
+#include <sys/mman.h>
+
+// register usage inside jit'd code:
+//   rdi = cpu_t::registers, rsi = cpu_t::memory
+//   r8d = executed instruction count, r9 = cycles out pointer, r10d = budget
+//   r11d = highest address a LOAD/STORE word can start at (memory_size - 4)
+//   eax, ecx, edx = scratch
+// nothing callee-saved is touched and no calls are made, so there is no frame.
+
+typedef struct jit_buffer_t {
+  unsigned char* data;
+  size_t length;
+  size_t capacity;
+  bool failed;                              // ran out of memory, everything emitted since is dropped
+
+  void emit8(unsigned char b);
+  void emit32(int v);
+  void emit(std::initializer_list<unsigned char> bytes);
+  void patch32(size_t at, int v);
+};
+
+typedef struct jit_fixup_t {
+  size_t at;                                // position of the rel32 to patch
+  int target;                               // instruction index (or -1 for the exit block)
+  int stub;                                 // bail stub index, -1 if not jumping to a stub
+};
+
+void jit_buffer_t::emit8(unsigned char b) {
+    if (failed)
+        return;
+
+    if (length + 1 > capacity) {
+        const size_t grown = capacity == 0 ? 4096 : capacity * 2;
+        unsigned char* resized = (unsigned char*)realloc(data, grown);
+        if (resized == NULL) {
+            failed = true;
+            return;
+        }
+        data = resized;
+        capacity = grown;
+    }
+    data[length++] = b;
+}
+
+void jit_buffer_t::emit32(int v) {
+    for (int i = 0; i < 4; ++i) {
+        emit8((unsigned char)((v >> (i * 8)) & 0xFF));
+    }
+}
+
+void jit_buffer_t::emit(std::initializer_list<unsigned char> bytes) {
+    for (unsigned char b : bytes) {
+        emit8(b);
+    }
+}
+
+void jit_buffer_t::patch32(size_t at, int v) {
+    if (!failed) {
+        memcpy(&data[at], &v, sizeof(int));
+    }
+}
+
+static int register_disp(int idx) { return idx * (int)sizeof(unsigned int); }
+
+static bool is_register(int idx) { return idx >= 0 && idx < REGISTER_SIZE; }
+
+// mov eax, [rdi + reg]
+static void emit_load_eax(jit_buffer_t* buf, int reg) { buf->emit({ 0x8B, 0x87 }); buf->emit32(register_disp(reg)); }
+// mov [rdi + reg], eax
+static void emit_store_eax(jit_buffer_t* buf, int reg) { buf->emit({ 0x89, 0x87 }); buf->emit32(register_disp(reg)); }
+// mov ecx, [rdi + reg]
+static void emit_load_ecx(jit_buffer_t* buf, int reg) { buf->emit({ 0x8B, 0x8F }); buf->emit32(register_disp(reg)); }
+// mov [rdi + reg], ecx
+static void emit_store_ecx(jit_buffer_t* buf, int reg) { buf->emit({ 0x89, 0x8F }); buf->emit32(register_disp(reg)); }
+// inc r8d
+static void emit_count(jit_buffer_t* buf) { buf->emit({ 0x41, 0xFF, 0xC0 }); }
+
+// jcc/jmp rel32 to be patched once every instruction has its native offset
+static void emit_jump(jit_buffer_t* buf, std::initializer_list<unsigned char> op, jit_fixup_t fixup, jit_fixup_t** fixups, int* fixup_count) {
+    buf->emit(op);
+    fixup.at = buf->length;
+    buf->emit32(0);
+
+    jit_fixup_t* resized = (jit_fixup_t*)realloc(*fixups, sizeof(jit_fixup_t) * ((*fixup_count) + 1));
+    if (resized == NULL) {
+        buf->failed = true;
+        return;
+    }
+    (*fixups) = resized;
+    (*fixups)[(*fixup_count)++] = fixup;
+}
+
+// a taken jump ends a basic block, leave at the target once the budget is spent.
+// always TAKEN_JUMP_SIZE bytes, so a conditional jump can short-jump over it
+static constexpr int TAKEN_JUMP_SIZE = 14;
+static void emit_taken_jump(jit_buffer_t* buf, int target, jit_fixup_t** fixups, int* fixup_count, int* stubs, int* stub_count) {
+    int stub = (*stub_count)++;
+    stubs[stub] = target;
+    buf->emit({ 0x45, 0x39, 0xD0 });                                                // cmp r8d, r10d
+    emit_jump(buf, { 0x0F, 0x83 }, { 0, -1, stub }, fixups, fixup_count);           // jae stub
+    emit_jump(buf, { 0xE9 }, { 0, target, -1 }, fixups, fixup_count);               // jmp target
+}
+
+// ZF/SF of lhs - rhs, always written (registers live in memory, there is
+// nothing to hold back). leaves ZF in edx for a fused jump
+static void emit_compare(jit_buffer_t* buf, int lhs, int rhs) {
+    buf->emit({ 0x31, 0xD2 });                                                      // xor edx, edx
+    emit_load_eax(buf, lhs);
+    buf->emit({ 0x2B, 0x87 }); buf->emit32(register_disp(rhs));                     // sub eax, [rdi + rhs]
+    buf->emit({ 0x0F, 0x94, 0xC2 });                                                // sete dl
+    buf->emit({ 0x89, 0x97 }); buf->emit32(register_disp(ZF));                      // mov [rdi + ZF], edx
+    buf->emit({ 0xC1, 0xE8, 0x1F });                                                // shr eax, 31
+    emit_store_eax(buf, SF);
+}
+
+// emits the native code for one instruction. returns false if the
+// instruction has to be left to the interpreter.
+static bool emit_instruction(jit_buffer_t* buf, const op_decoded_t* inst, int idx,
+                             jit_fixup_t** fixups, int* fixup_count, int* stubs, int* stub_count) {
+    const int* operands = inst->operands;
+
+    switch (inst->type) {
+        case PUSH: {
+            if (inst->length != 1)
+                break;
+
+            // overflow goes back to the interpreter, which reports it
+            int stub = (*stub_count)++;
+            stubs[stub] = idx;
+            emit_load_ecx(buf, SP);
+            buf->emit({ 0x81, 0xF9 }); buf->emit32(STACK_SIZE);                    // cmp ecx, STACK_SIZE
+            emit_jump(buf, { 0x0F, 0x83 }, { 0, -1, stub }, fixups, fixup_count);   // jae stub
+
+            emit_count(buf);
+            buf->emit({ 0xC7, 0x04, 0x0E }); buf->emit32(operands[0]);              // mov dword [rsi + rcx], imm32
+            buf->emit({ 0x83, 0xC1, 0x04 });                                        // add ecx, 4
+            emit_store_ecx(buf, SP);
+            return true;
+        }
+
+        case POP: {
+            if (inst->length != 1 || !is_register(operands[0]))
+                break;
+
+            // underflow, or an SP moved past the stack, goes back to the interpreter
+            int stub = (*stub_count)++;
+            stubs[stub] = idx;
+            emit_load_ecx(buf, SP);
+            buf->emit({ 0x83, 0xF9, 0x04 });                                        // cmp ecx, 4
+            emit_jump(buf, { 0x0F, 0x82 }, { 0, -1, stub }, fixups, fixup_count);   // jb stub
+            buf->emit({ 0x81, 0xF9 }); buf->emit32(STACK_SIZE);                    // cmp ecx, STACK_SIZE
+            emit_jump(buf, { 0x0F, 0x87 }, { 0, -1, stub }, fixups, fixup_count);   // ja stub
+
+            emit_count(buf);
+            buf->emit({ 0x83, 0xE9, 0x04 });                                        // sub ecx, 4
+            emit_store_ecx(buf, SP);
+            buf->emit({ 0x8B, 0x04, 0x0E });                                        // mov eax, [rsi + rcx]
+            emit_store_eax(buf, operands[0]);
+            return true;
+        }
+
+        case MOVI: {
+            if (inst->length != 2 || !is_register(operands[0]))
+                break;
+
+            // the interpreter replays the push/pop on overflow
+            int stub = (*stub_count)++;
+            stubs[stub] = idx;
+            emit_load_ecx(buf, SP);
+            buf->emit({ 0x81, 0xF9 }); buf->emit32(STACK_SIZE);                    // cmp ecx, STACK_SIZE
+            emit_jump(buf, { 0x0F, 0x83 }, { 0, -1, stub }, fixups, fixup_count);   // jae stub
+
+            emit_count(buf);
+            buf->emit({ 0xC7, 0x87 }); buf->emit32(register_disp(operands[0]));     // mov dword [rdi + reg], imm32
+            buf->emit32(operands[1]);
+            return true;
+        }
+
+        case ADD:
+        case SUB:
+        case MUL:
+        case AND:
+        case OR:
+        case XOR: {
+            if (inst->length != 2 || !is_register(operands[0]) || !is_register(operands[1]))
+                break;
+
+            emit_count(buf);
+            emit_load_eax(buf, operands[0]);
+            switch (inst->type) {
+                case ADD: buf->emit({ 0x03, 0x87 }); break;                         // add eax, [rdi + rhs]
+                case SUB: buf->emit({ 0x2B, 0x87 }); break;                         // sub eax, [rdi + rhs]
+                case MUL: buf->emit({ 0x0F, 0xAF, 0x87 }); break;                   // imul eax, [rdi + rhs]
+                case AND: buf->emit({ 0x23, 0x87 }); break;                         // and eax, [rdi + rhs]
+                case OR:  buf->emit({ 0x0B, 0x87 }); break;                         // or eax, [rdi + rhs]
+                case XOR: buf->emit({ 0x33, 0x87 }); break;                         // xor eax, [rdi + rhs]
+            }
+            buf->emit32(register_disp(operands[1]));
+            emit_store_eax(buf, operands[0]);
+            return true;
+        }
+
+        case DIV: {
+            if (inst->length != 2 || !is_register(operands[0]) || !is_register(operands[1]))
+                break;
+
+            // registers are unsigned, so this is an unsigned divide like the interpreter's.
+            // a 0 divisor goes back to the interpreter, which reports it
+            int stub = (*stub_count)++;
+            stubs[stub] = idx;
+            buf->emit({ 0x83, 0xBF }); buf->emit32(register_disp(operands[1]));     // cmp dword [rdi + rhs], 0
+            buf->emit8(0x00);
+            emit_jump(buf, { 0x0F, 0x84 }, { 0, -1, stub }, fixups, fixup_count);   // je stub
+
+            emit_count(buf);
+            emit_load_eax(buf, operands[0]);
+            buf->emit({ 0x31, 0xD2 });                                              // xor edx, edx
+            buf->emit({ 0xF7, 0xB7 }); buf->emit32(register_disp(operands[1]));     // div dword [rdi + rhs]
+            emit_store_eax(buf, operands[0]);
+            return true;
+        }
+
+        case ADDI:
+        case SUBI:
+        case ANDI:
+        case ORI:
+        case XORI: {
+            if (inst->length != 2 || !is_register(operands[0]))
+                break;
+
+            // op dword [rdi + reg], imm32, the /digit picks the operation
+            emit_count(buf);
+            switch (inst->type) {
+                case ADDI: buf->emit({ 0x81, 0x87 }); break;                        // add
+                case SUBI: buf->emit({ 0x81, 0xAF }); break;                        // sub
+                case ANDI: buf->emit({ 0x81, 0xA7 }); break;                        // and
+                case ORI:  buf->emit({ 0x81, 0x8F }); break;                        // or
+                case XORI: buf->emit({ 0x81, 0xB7 }); break;                        // xor
+            }
+            buf->emit32(register_disp(operands[0]));
+            buf->emit32(operands[1]);
+            return true;
+        }
+
+        case MULI: {
+            if (inst->length != 2 || !is_register(operands[0]))
+                break;
+
+            emit_count(buf);
+            buf->emit({ 0x69, 0x87 }); buf->emit32(register_disp(operands[0]));     // imul eax, [rdi + reg], imm32
+            buf->emit32(operands[1]);
+            emit_store_eax(buf, operands[0]);
+            return true;
+        }
+
+        case DIVI: {
+            // dividing by 0 is left to the interpreter, which reports it
+            if (inst->length != 2 || !is_register(operands[0]) || operands[1] == 0)
+                break;
+
+            emit_count(buf);
+            emit_load_eax(buf, operands[0]);
+            buf->emit({ 0x31, 0xD2 });                                              // xor edx, edx
+            buf->emit8(0xB9); buf->emit32(operands[1]);                             // mov ecx, imm32
+            buf->emit({ 0xF7, 0xF1 });                                              // div ecx
+            emit_store_eax(buf, operands[0]);
+            return true;
+        }
+
+        case LOAD:
+        case STORE: {
+            if (inst->length != 3 || !is_register(operands[0]) || !is_register(operands[1]))
+                break;
+
+            // an address outside guest memory goes back to the interpreter, which reports it
+            int stub = (*stub_count)++;
+            stubs[stub] = idx;
+            emit_load_eax(buf, operands[1]);
+            buf->emit8(0x05); buf->emit32(operands[2]);                             // add eax, imm32
+            buf->emit({ 0x44, 0x39, 0xD8 });                                        // cmp eax, r11d
+            emit_jump(buf, { 0x0F, 0x87 }, { 0, -1, stub }, fixups, fixup_count);   // ja stub
+
+            emit_count(buf);
+            if (inst->type == LOAD) {
+                buf->emit({ 0x8B, 0x0C, 0x06 });                                    // mov ecx, [rsi + rax]
+                emit_store_ecx(buf, operands[0]);
+            } else {
+                emit_load_ecx(buf, operands[0]);
+                buf->emit({ 0x89, 0x0C, 0x06 });                                    // mov [rsi + rax], ecx
+            }
+            return true;
+        }
+
+        case CMP: {
+            if (inst->length != 2 || !is_register(operands[0]) || !is_register(operands[1]))
+                break;
+
+            emit_count(buf);
+            emit_compare(buf, operands[0], operands[1]);
+            return true;
+        }
+
+        case JMP: {
+            emit_count(buf);
+            if (inst->length == 1 && inst->target >= 0) {
+                emit_taken_jump(buf, inst->target, fixups, fixup_count, stubs, stub_count);
+            }
+            return true;
+        }
+
+        case JE:
+        case JNE: {
+            emit_count(buf);
+            if (inst->length == 1 && inst->target >= 0) {
+                buf->emit({ 0x83, 0xBF }); buf->emit32(register_disp(ZF)); buf->emit8(0x00);   // cmp dword [rdi + ZF], 0
+                buf->emit8(inst->type == JE ? 0x74 : 0x75); buf->emit8(TAKEN_JUMP_SIZE);   // je/jne over the taken path
+                emit_taken_jump(buf, inst->target, fixups, fixup_count, stubs, stub_count);
+            }
+            return true;
+        }
+
+        case CMPJE:
+        case CMPJNE: {
+            if (inst->length != 3 || !is_register(operands[0]) || !is_register(operands[1]))
+                break;
+
+            emit_count(buf);
+            emit_compare(buf, operands[0], operands[1]);
+            if (inst->target >= 0) {
+                buf->emit({ 0x85, 0xD2 });                                          // test edx, edx
+                buf->emit8(inst->type == CMPJE ? 0x74 : 0x75); buf->emit8(TAKEN_JUMP_SIZE);
+                emit_taken_jump(buf, inst->target, fixups, fixup_count, stubs, stub_count);
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+jit_program_t* jit_compile(const op_decoded_program_t* program) {
+    if (program == NULL)
+        return NULL;
+
+    jit_buffer_t buf = { NULL, 0, 0, false };
+    jit_fixup_t* fixups = NULL;
+    int fixup_count = 0;
+    int stub_count = 0;
+    int* stubs = (int*)malloc(sizeof(int) * (program->length + 1));
+    int* offsets = (int*)malloc(sizeof(int) * (program->length + 1));
+    int compiled = 0;
+    if (stubs == NULL || offsets == NULL) {
+        LOG_ERROR("[-] jit_compile() failed to allocate its tables");
+        free(stubs);
+        free(offsets);
+        return NULL;
+    }
+
+    // prologue: entered with rdx = native address to start at, rcx = cycles pointer, r8d = budget, r9d = memory_size
+    buf.emit({ 0x45, 0x89, 0xCB });                                                 // mov r11d, r9d
+    buf.emit({ 0x41, 0x83, 0xEB, 0x04 });                                           // sub r11d, 4
+    buf.emit({ 0x45, 0x89, 0xC2 });                                                 // mov r10d, r8d
+    buf.emit({ 0x45, 0x31, 0xC0 });                                                 // xor r8d, r8d
+    buf.emit({ 0x49, 0x89, 0xC9 });                                                 // mov r9, rcx
+    buf.emit({ 0xFF, 0xE2 });                                                       // jmp rdx
+
+    for (int i = 0; i < program->length; ++i) {
+        offsets[i] = (int)buf.length;
+        if (emit_instruction(&buf, &program->instructions[i], i, &fixups, &fixup_count, stubs, &stub_count)) {
+            compiled++;
+            continue;
+        }
+
+        // not compilable, hand this instruction back to the interpreter
+        buf.emit8(0xB8); buf.emit32(i);                                             // mov eax, i
+        emit_jump(&buf, { 0xE9 }, { 0, -1, -1 }, &fixups, &fixup_count);
+    }
+
+    // falling off the end (or jumping to it) finishes the program
+    offsets[program->length] = (int)buf.length;
+    buf.emit8(0xB8); buf.emit32(program->length);                                  // mov eax, length
+
+    const size_t exit_offset = buf.length;
+    buf.emit({ 0x45, 0x01, 0x01 });                                                 // add [r9], r8d
+    buf.emit8(0xC3);                                                                // ret
+
+    // bail stubs, the interpreter redoes the checks and reports the error. the
+    // budget stubs of jumps land here too and hand back the jump target
+    int* stub_offsets = (int*)malloc(sizeof(int) * (stub_count + 1));
+    for (int i = 0; stub_offsets != NULL && i < stub_count; ++i) {
+        stub_offsets[i] = (int)buf.length;
+        buf.emit8(0xB8); buf.emit32(stubs[i]);                                      // mov eax, idx
+        buf.emit8(0xE9); buf.emit32((int)exit_offset - (int)(buf.length + 4));      // jmp exit
+    }
+
+    // out of memory somewhere along the way, the caller falls back to the interpreter
+    if (buf.failed || stub_offsets == NULL) {
+        LOG_ERROR("[-] jit_compile() ran out of memory for the code buffer");
+        free(stub_offsets);
+        free(fixups);
+        free(stubs);
+        free(buf.data);
+        free(offsets);
+        return NULL;
+    }
+
+    for (int i = 0; i < fixup_count; ++i) {
+        const jit_fixup_t* fixup = &fixups[i];
+        int destination = fixup->stub >= 0 ? stub_offsets[fixup->stub]
+                        : fixup->target >= 0 ? offsets[fixup->target]
+                        : (int)exit_offset;
+        buf.patch32(fixup->at, destination - (int)(fixup->at + 4));
+    }
+
+    free(stub_offsets);
+    free(fixups);
+    free(stubs);
+
+    void* code = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        LOG_ERROR("[-] jit_compile() failed to map executable memory");
+        free(buf.data);
+        free(offsets);
+        return NULL;
+    }
+
+    memcpy(code, buf.data, buf.length);
+    free(buf.data);
+    if (mprotect(code, buf.length, PROT_READ | PROT_EXEC) != 0) {
+        LOG_ERROR("[-] jit_compile() failed to make code executable");
+        munmap(code, buf.length);
+        free(offsets);
+        return NULL;
+    }
+
+    jit_program_t* jit = (jit_program_t*)malloc(sizeof(jit_program_t));
+    if (jit == NULL) {
+        LOG_ERROR("[-] jit_compile() failed to allocate jit_program_t");
+        munmap(code, buf.length);
+        free(offsets);
+        return NULL;
+    }
+    {
+        jit->code = (unsigned char*)code;
+        jit->code_size = buf.length;
+        jit->length = program->length;
+        jit->offsets = offsets;
+        jit->compiled = compiled;
+        jit->entry = (jit_entry_t)code;
+    }
+
+    LOG_MSG("[+] JIT compiled " << compiled << "/" << program->length << " instructions (" << buf.length << " bytes)");
+    return jit;
+}
+
+void jit_free(jit_program_t* jit) {
+    if (jit == NULL)
+        return;
+
+    munmap(jit->code, jit->code_size);
+    free(jit->offsets);
+    free(jit);
+}
+
+#else
+
+jit_program_t* jit_compile(const op_decoded_program_t* program) {
+    LOG_WARN("[!] JIT is not available on this platform");
+    return NULL;
+}
+
+void jit_free(jit_program_t* jit) {}
+
+#endif
+
+const void* jit_program_t::address_of(int idx) {
+    return &this->code[this->offsets[idx]];
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "opcodes.h"
+#include "decoder.h"
+#include "machine.h"
+
+// the jit emits raw x86-64 (sysv abi) into mmap'd memory, so it only
+// exists on linux x86-64. everything else keeps using the interpreter.
+#if defined(__x86_64__) && defined(__linux__)
+#define CEMU_HAS_JIT 1
+#else
+#define CEMU_HAS_JIT 0
+#endif
+
+// native entry: runs from 'start' until it reaches the end of the program, an
+// instruction it couldn't compile, or a taken jump after 'budget' instructions,
+// and returns the index of the instruction it stopped at (not executed yet).
+// 'cycles' is incremented by the number of instructions executed natively.
+// LOAD/STORE outside the first 'memory_size' bytes of 'memory' bail.
+typedef int (*jit_entry_t)(unsigned int* registers, unsigned char* memory, const void* start, unsigned int* cycles,
+                           unsigned int budget, unsigned int memory_size);
+
+typedef struct jit_program_t {
+  unsigned char* code;
+  size_t code_size;
+  int length;
+  int* offsets;                             // native offset of every instruction (length + 1 entries)
+  int compiled;                             // number of instructions compiled to native code
+  jit_entry_t entry;
+
+  const void* address_of(int idx);
+};
+
+jit_program_t* jit_compile(const op_decoded_program_t* program);
+void jit_free(jit_program_t* jit);
+
+#endif // __JIT_H__
\ No newline at end of file
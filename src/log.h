@@ -3,11 +3,37 @@
 
 #include "stdafx.h"
 
-// TODO: write a better implementation of this god awful method?
-// thinking I could use something like inheritance... although
-// i don't want to ruin the structure of this code with classes
-// i like the current system i got going on. maybe regular methods
-// that take in a file name, line number, message and args? (with macro addition)
-#define LOG_MSG(msg) std::cout << msg << std::endl
+// log levels, anything below CEMU_LOG_LEVEL is compiled out. pass
+// -DCEMU_LOG_LEVEL=LOG_LEVEL_WARN (or _NONE) to strip the chatter from a build.
+// per-instruction events don't go through here at all, see trace.h
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE  4
+
+#ifndef CEMU_LOG_LEVEL
+#define CEMU_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// runtime floor on top of the compile-time one, e.g. batch runs only want warnings
+inline int log_runtime_level = LOG_LEVEL_DEBUG;
+
+#define LOG_AT(level, msg)                                                  \
+    do {                                                                    \
+        if constexpr ((level) >= CEMU_LOG_LEVEL) {                          \
+            if ((level) >= log_runtime_level) {                             \
+                std::cout << msg << '\n';                                   \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+
+#define LOG_DEBUG(msg) LOG_AT(LOG_LEVEL_DEBUG, msg)
+#define LOG_INFO(msg)  LOG_AT(LOG_LEVEL_INFO, msg)
+#define LOG_WARN(msg)  LOG_AT(LOG_LEVEL_WARN, msg)
+#define LOG_ERROR(msg) LOG_AT(LOG_LEVEL_ERROR, msg)
+
+// the original catch-all, same as LOG_INFO
+#define LOG_MSG(msg) LOG_INFO(msg)
 
 #endif // __LOG_H__
\ No newline at end of file
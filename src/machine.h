@@ -0,0 +1,122 @@
+#ifndef __MACHINE_H__
+#define __MACHINE_H__
+
+#include "stdafx.h"
+#include "log.h"
+
+#include <climits>
+
+static constexpr int MEMORY_SIZE = 1024 * 8 * 4 * 2;                 // default guest address space
+static constexpr int MEMORY_MAX_SIZE = 16 * 1024 * 1024;             // largest one cpu_t::initialize() accepts
+static constexpr int MEMORY_PAGE_SIZE = 4096;
+static constexpr int STACK_SIZE = 1024;
+
+static constexpr int REGISTER_SIZE  = 14;
+static constexpr int R0             = 0x00;
+static constexpr int R1             = 0x01;
+static constexpr int R2             = 0x02;
+static constexpr int R3             = 0x03;
+static constexpr int R4             = 0x04;
+static constexpr int R5             = 0x05;
+static constexpr int R6             = 0x06;
+static constexpr int R7             = 0x07;
+static constexpr int R8             = 0x08;
+static constexpr int PC             = 0x09;     // current program counter, see below
+static constexpr int SP             = 0x0A;     // current stack location
+static constexpr int PX             = 0x0B;     // max program counter length
+static constexpr int ZF             = 0x0C;     // zero flag (used in CMP)
+static constexpr int SF             = 0x0D;     // sign flag (used in compare, or jump ifs)
+
+// PC is only guaranteed at slice boundaries: run_for() sets it to where the
+// run stopped (or will resume). within a slice the switch and in-place
+// engines move it with every instruction, the threaded, block, jit and aot
+// engines leave it alone. interrupt handlers, the trace and the profiler
+// work from the instruction itself and never read it.
+
+// labels-as-values (goto *ptr) is a GCC/Clang extension, msvc builds
+// only get the switch engine
+#if defined(__GNUC__) || defined(__clang__)
+#define CEMU_HAS_COMPUTED_GOTO 1
+#else
+#define CEMU_HAS_COMPUTED_GOTO 0
+#endif
+
+// for an instruction body the block engine needs inlined into its loop
+#if defined(__GNUC__) || defined(__clang__)
+#define CEMU_ALWAYS_INLINE __attribute__((always_inline)) inline
+#elif defined(_MSC_VER)
+#define CEMU_ALWAYS_INLINE __forceinline
+#else
+#define CEMU_ALWAYS_INLINE inline
+#endif
+
+enum cpu_engine_t : unsigned char {
+    ENGINE_SWITCH       = 0x00,             // one switch over the decoded instructions (reference engine)
+    ENGINE_THREADED     = 0x01,             // direct-threaded code, every handler dispatches the next one
+    ENGINE_JIT          = 0x02,             // x86-64 template jit, falls back to execute_inst() per instruction
+    ENGINE_INPLACE      = 0x03,             // decodes each step straight out of cpu_t::memory, sees patched code
+    ENGINE_AOT          = 0x04,             // program translated to C, built by the host compiler and dlopen()ed
+    ENGINE_BLOCK        = 0x05,             // the switch engine a basic block at a time, blocks chained to their successors
+};
+
+// what cpu_t::run_for() / run_until() stopped on
+enum cpu_status_t : unsigned char {
+    CPU_HALTED          = 0x00,             // ran off the end of the program, the next run starts over
+    CPU_YIELDED         = 0x01,             // out of budget at a block boundary, the next run resumes there
+};
+
+// returned in place of an instruction index by an engine step that used up
+// the budget, bigger than any index so every 'idx < length' loop stops on it
+static constexpr int CPU_YIELD = INT_MAX;
+
+// same, for an interrupt that ended the run (INT 0xAA00). the run halts
+// as if it had run off the end of the program
+static constexpr int CPU_EXIT = INT_MAX - 1;
+
+// instructions per run_for() between two clock reads in run_until()
+static constexpr unsigned int CPU_TIME_SLICE = 4096;
+
+struct cpu_info_t {
+    unsigned int total_run_cycles;
+    unsigned int program_counter_lower_bound;
+    unsigned int program_counter_higher_bound;
+};
+
+// "switch", "threaded", "jit", "inplace", "aot", "block"
+inline bool parse_engine_name(const char* name, cpu_engine_t* engine) {
+    if (strcmp(name, "switch") == 0) {
+        (*engine) = ENGINE_SWITCH;
+    } else if (strcmp(name, "threaded") == 0) {
+#if CEMU_HAS_COMPUTED_GOTO
+        (*engine) = ENGINE_THREADED;
+#else
+        LOG_WARN("[!] Threaded engine is not available in this build, using switch");
+        (*engine) = ENGINE_SWITCH;
+#endif
+    } else if (strcmp(name, "jit") == 0) {
+        (*engine) = ENGINE_JIT;
+    } else if (strcmp(name, "inplace") == 0) {
+        (*engine) = ENGINE_INPLACE;
+    } else if (strcmp(name, "aot") == 0) {
+        (*engine) = ENGINE_AOT;
+    } else if (strcmp(name, "block") == 0) {
+        (*engine) = ENGINE_BLOCK;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char* engine_name(cpu_engine_t engine) {
+    switch (engine) {
+        case ENGINE_SWITCH: return "switch";
+        case ENGINE_THREADED: return "threaded";
+        case ENGINE_JIT: return "jit";
+        case ENGINE_INPLACE: return "inplace";
+        case ENGINE_AOT: return "aot";
+        case ENGINE_BLOCK: return "block";
+    }
+    return "unknown";
+}
+
+#endif // __MACHINE_H__
\ No newline at end of file
@@ -4,465 +4,229 @@
 
 #include "stdafx.h"
 #include "log.h"
-#include "binary.h"
-#include "opcodes.h"
 #include "ilbuilder.h"
-
-static constexpr int MEMORY_SIZE = 1024 * 8 * 4 * 2;
-static constexpr int MEMORY_PADDING_SIZE = 16 * 16 * 2 * 4 * 2;
-static constexpr int STACK_SIZE = 1024;
-
-static constexpr int REGISTER_SIZE  = 14;
-static constexpr int R0             = 0x00;
-static constexpr int R1             = 0x01;
-static constexpr int R2             = 0x02;
-static constexpr int R3             = 0x03;
-static constexpr int R4             = 0x04;
-static constexpr int R5             = 0x05;
-static constexpr int R6             = 0x06;
-static constexpr int R7             = 0x07;
-static constexpr int R8             = 0x08;
-static constexpr int PC             = 0x09;     // current program counter
-static constexpr int SP             = 0x0A;     // current stack location
-static constexpr int PX             = 0x0B;     // max program counter length
-static constexpr int ZF             = 0x0C;     // zero flag (used in CMP)
-static constexpr int SF             = 0x0D;     // sign flag (used in compare, or jump ifs)
-
-struct cpu_info_t {
-    unsigned int total_run_cycles;
-    unsigned int program_counter_lower_bound;
-    unsigned int program_counter_higher_bound;
+#include "optimizer.h"
+#include "cpu.h"
+#include "batch.h"
+#include "assembler.h"
+
+struct cemu_options_t {
+    cpu_engine_t engine;
+    bool optimize;
+    bool trace;
+    bool profile;
+    bool profile_json;
+    const char* trace_dump;
+    const char* trace_decode;
+    int batch;                              // > 0 runs that many copies of the program through run_batch()
+    int threads;
+    unsigned int budget;                    // > 0 stops the program after about that many instructions
+    unsigned int memory_size;
+    const char* write_path;                 // write the program as a bytecode file instead of running it
+    const char* load_path;                  // run a bytecode file instead of the built-in program
+    const char* asm_path;                   // assemble this source instead of using the built-in program
 };
 
-struct cpu_t {
-    op_program_t* program;
-    cpu_info_t* info;
-    unsigned char memory[MEMORY_SIZE];
-    unsigned int registers[REGISTER_SIZE];
-
-#pragma region Memory
-    bool asm_check_if_free_memory(int size, int* idx) {
-        // traverse memory space to check any memory starting
-        // with [0x0F, 0xFF, 0x01] (0x01 indicates free memory space)
-        for (int i = 0; i < MEMORY_SIZE; ++i) {
-            if ((i + 2 + size < MEMORY_SIZE) && memory[i] == 0x0F && 
-                memory[i + 1] == 0xFF && memory[i + 2] == 0x01) {
-                (*idx) = i + 3;
-                return true;
-            }
-        }
-
-        LOG_MSG("[D] No space found for memory of size : " << size);
-        (*idx) = 0;
-        return false;
-    }
-
-    bool asm_change_free_memory_bit(int idx, unsigned char bit) {
-        if (idx >= MEMORY_SIZE) return false;
-        memory[idx - 1] = 0x02;
-        return true;
-    }
-
-    bool asm_misvalid(int idx) {
-        return (idx >= 0 && idx <= MEMORY_SIZE);
-    }
-
-    void* asm_mofaddr(int idx) {
-        return NULL;
-    }
-
-    void* asm_malloc(int size) {
-        int idx = 0;
-        if (!asm_check_if_free_memory(size, &idx))
-            return NULL;
-        if (!asm_change_free_memory_bit(idx, 0x02))
-            return NULL;
-
-        memory[idx - 3] = (size >> 8) & 0xFF;  // size (high byte)
-        memory[idx - 2] = size & 0xFF;         // size (low byte)
-        return &memory[idx];
-    }
-
-    void asm_mfree(void* ptr) {
-        if (ptr == NULL) {
-            LOG_MSG("[D] Invalid pointer provided to free");
-            return;
-        }
-
-        unsigned char* p = static_cast<unsigned char*>(ptr);
-        int idx = p - memory;
-        if (idx < 0 || idx >= MEMORY_SIZE) {
-            LOG_MSG("[D] Invalid pointer range");
-            return;
-        }
-
-        int size = (memory[idx - 3] << 8) | memory[idx - 2];
-
-        memory[idx - 3] = 0x0F;
-        memory[idx - 2] = 0xFF;
-        if (!asm_change_free_memory_bit(idx, 0x01)) {
-            return;
-        }
-    }
+// --engine=switch|threaded|jit|inplace|aot|block
+// --no-optimize          skip optimize_program()
+// --trace                record every executed instruction and print them at the end
+// --trace-dump=PATH      record, and write the raw events to PATH instead
+// --trace-decode=PATH    print a file written by --trace-dump and exit
+// --profile              per-opcode counts/time, hot offsets and jump targets after the run
+// --profile-json         same, as json
+// --batch=N              run N copies of the program (R0 = copy index) on a thread pool
+// --threads=N            batch workers, default one per core
+// --budget=N             give up after about N instructions (checked at every taken jump)
+// --memory=KB            guest address space, default 64, pages are only backed once touched
+// --write=PATH           write the (optimized) program to a bytecode file and exit
+// --load=PATH            map a bytecode file and run it
+// --asm=PATH             assemble PATH ('-' for stdin) and use that program, see assembler.h
+static cemu_options_t parse_options(int argc, char* argv[]) {
+    cemu_options_t options = { ENGINE_SWITCH, true, false, false, false, NULL, NULL, 0, 0, 0, MEMORY_SIZE, NULL, NULL, NULL };
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--engine=", 9) == 0) {
+            if (!parse_engine_name(argv[i] + 9, &options.engine)) {
+                LOG_WARN("[!] Unknown engine: " << argv[i] + 9);
+            }
+        } else if (strcmp(argv[i], "--no-optimize") == 0) {
+            options.optimize = false;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            options.trace = true;
+        } else if (strncmp(argv[i], "--trace-dump=", 13) == 0) {
+            options.trace = true;
+            options.trace_dump = argv[i] + 13;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            options.profile = true;
+        } else if (strcmp(argv[i], "--profile-json") == 0) {
+            options.profile = true;
+            options.profile_json = true;
+        } else if (strncmp(argv[i], "--trace-decode=", 15) == 0) {
+            options.trace_decode = argv[i] + 15;
+        } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+            options.batch = std::max(0, atoi(argv[i] + 8));
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            options.threads = std::max(0, atoi(argv[i] + 10));
+        } else if (strncmp(argv[i], "--budget=", 9) == 0) {
+            options.budget = (unsigned int)std::max(0, atoi(argv[i] + 9));
+        } else if (strncmp(argv[i], "--write=", 8) == 0) {
+            options.write_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--load=", 7) == 0) {
+            options.load_path = argv[i] + 7;
+        } else if (strncmp(argv[i], "--asm=", 6) == 0) {
+            options.asm_path = argv[i] + 6;
+        } else if (strncmp(argv[i], "--memory=", 9) == 0) {
+            options.memory_size = (unsigned int)std::max(0, atoi(argv[i] + 9)) * 1024;
+        } else {
+            LOG_WARN("[!] Unknown argument: " << argv[i]);
+        }
+    }
+    return options;
+}
 
-    int asm_maddrof(void* ptr) {
-        if (ptr == NULL) {
-            LOG_MSG("[D] Invalid pointer provided to get address of");
-            return 0;
-        }
-
-        unsigned char* p = static_cast<unsigned char*>(ptr);
-        return std::max(0, static_cast<int>(p - memory));
+int main(int argc, char* argv[]) {
+    const cemu_options_t options = parse_options(argc, argv);
+    if (options.trace_decode != NULL) {
+        return trace_decode(options.trace_decode) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    void dump_memory(int startIndex, int chunkLimit) {
-        const int CHUNK_SIZE = 15;
-        if (startIndex < 0 || startIndex >= MEMORY_SIZE) {
-            LOG_MSG("[ERROR] Invalid startIndex: " << startIndex);
-            return;
+    trace_enable(options.trace);
+    // the assembly keeps its labels, the program is taken over from it
+    assembly_t* assembly = NULL;
+    op_program_t* program_ptr = NULL;
+    if (options.asm_path != NULL) {
+        assembly = assemble_file(options.asm_path);
+        if (assembly == NULL) {
+            return EXIT_FAILURE;
         }
+        LOG_INFO("[+] Assembled " << assembly->program->length << " instructions, " << assembly->label_count
+            << " labels from " << assembly->lines << " lines");
+        program_ptr = assembly->program;
+        assembly->program = NULL;
+    } else {
+        program_ptr = create_program();
+        bool built = true;
 
-        int endIndex = startIndex + (chunkLimit * CHUNK_SIZE);
-        if (endIndex > MEMORY_SIZE) {
-            endIndex = MEMORY_SIZE;
+        // PUSH 0x01 (int)
+        {
+            int operands[] = { 25 };
+            size_t sizes[] = { sizeof(int) };
+            built = add_instruction(program_ptr, PUSH, 1, sizes, operands) && built;
         }
 
-        LOG_MSG("======= MEM DUMP (" << (endIndex - startIndex) << " TOTAL) =======");
-        for (int i = startIndex; i < endIndex; i += CHUNK_SIZE) {
-            printf("0x%08X: ", i);
-            for (int j = 0; j < CHUNK_SIZE; ++j) {
-                if (i + j < endIndex) {
-                    printf("%02X ", memory[i + j]);
-                } else {
-                    printf("   ");
-                }
-            }
-
-            printf(" | ");
-            for (int j = 0; j < CHUNK_SIZE; ++j) {
-                if (i + j < endIndex) {
-                    unsigned char byte = memory[i + j];
-                    if (isprint(byte)) {
-                        printf("%c", byte);
-                    } else {
-                        printf("~");
-                    }
-                }
-            }
-            printf("\n");
+        // POP r5
+        {
+            int operands[] = { R5 };
+            size_t sizes[] = { sizeof(int) };
+            built = add_instruction(program_ptr, POP, 1, sizes, operands) && built;
         }
-        LOG_MSG("===============================================");
-    }
-#pragma endregion
-
-#pragma region Stack
 
-    void asm_stack_push(int value) {
-        if (registers[SP] >= STACK_SIZE) {
-            LOG_MSG("[ERROR] Stack overflow");
-            return;
+        // INT 0xAA01 (ping)
+        {
+            int operands[] = { INTERRUPT_PING };
+            size_t sizes[] = { sizeof(int) };
+            built = add_instruction(program_ptr, INT, 1, sizes, operands) && built;
         }
-        
-        memory[registers[SP]] = (value >> 24) & 0xFF;
-        memory[registers[SP] + 1] = (value >> 16) & 0xFF;
-        memory[registers[SP] + 2] = (value >> 8) & 0xFF;
-        memory[registers[SP] + 3] = value & 0xFF;
-        registers[SP] += 4;
-    }
 
-    int asm_stack_pop() {
-        if (registers[SP] < 4) {
-            LOG_MSG("[ERROR] Stack underflow");
-            return 0;
+        if (!built) {
+            LOG_ERROR("[-] Failed to build the sample program");
+            free_program(program_ptr);
+            return EXIT_FAILURE;
         }
-        
-        registers[SP] -= 4;
-        return (memory[registers[SP]] << 24) |
-            (memory[registers[SP] + 1] << 16) |
-            (memory[registers[SP] + 2] << 8) |
-            memory[registers[SP] + 3];
     }
 
-#pragma endregion
-
-    void initialize_memory() {
-        // clean memory to fresh slate
-        for (int i = 0; i < MEMORY_SIZE; ++i) {
-            memory[i] = 0x00;
-        }
-
-        // init stack
-        for (int i = 0; i < STACK_SIZE; ++i) {
-            memory[i] = 0x00;
-        }
-
-        // init mem
-        for (int i = STACK_SIZE; i < MEMORY_SIZE; ++i) {
-            // init blocks of mem
-            if (i + 2 < MEMORY_SIZE && (memory[i] != 0x0F && memory[i + 1] != 0xFF)) {
-                memory[i] = 0x0F;
-                memory[i + 1] = 0xFF;
-                memory[i + 2] = 0x01;
-                i += MEMORY_PADDING_SIZE;
+    if (options.optimize) {
+        optimize_report_t report;
+        int* index_map = (int*)malloc(sizeof(int) * (program_ptr->length + 1));
+        auto optimized_ptr = index_map != NULL ? optimize_program(program_ptr, &report, index_map) : NULL;
+        if (optimized_ptr != NULL) {
+            print_optimize_report(&report);
+            for (int i = 0; assembly != NULL && i < assembly->label_count; ++i) {
+                assembly->labels[i].index = index_map[assembly->labels[i].index];
             }
+            free_program(program_ptr);
+            program_ptr = optimized_ptr;
+        } else {
+            LOG_WARN("[!] Running the program unoptimized");
         }
-
-        LOG_MSG("[+] Initialized memory");
+        free(index_map);
     }
 
-    void initialize_registers() {
-        // clean registers to fresh slate
-        for (int i = 0; i < REGISTER_SIZE; ++i) {
-            registers[i] = 0x00;
-        }
-
-        registers[SP] = 0x00;
-        LOG_MSG("[+] Initialized registers");
+    if (options.write_path != NULL) {
+        const bool written = write_bytecode_file(options.write_path, program_ptr,
+            assembly != NULL ? assembly->labels : NULL, assembly != NULL ? assembly->label_count : 0);
+        free_program(program_ptr);
+        free_assembly(assembly);
+        return written ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    void initialize_bytecode() {
-        auto stream_ptr = create_binary_stream(true);
-        if (stream_ptr == NULL) {
-            LOG_MSG("[D] Failed to create binary stream");
-            return;
+    if (options.batch > 0) {
+        auto jobs = (batch_job_t*)calloc(options.batch, sizeof(batch_job_t));
+        for (int i = 0; i < options.batch; ++i) {
+            jobs[i].program = program_ptr;
+            jobs[i].inputs[R0] = (unsigned int)i;
         }
 
-        for (int i = 0; i < program->length; ++i) {
-            auto inst_ptr = program->instructions[i];
-            stream_ptr->write_uint8(inst_ptr->type);
-            stream_ptr->write_int32(inst_ptr->length);
-            for (int j = 0; j < inst_ptr->length; ++j) {
-                size_t operand_size = inst_ptr->sizes[j];
-                void* operand = (char*)inst_ptr->operands + j * operand_size;
-                unsigned char* operand_buffer = static_cast<unsigned char*>(operand);
-                stream_ptr->append(operand_buffer, operand_size);
+        batch_stats_t stats;
+        const bool ok = run_batch(jobs, options.batch, options.engine, options.threads, &stats);
+        if (ok) {
+            int completed = 0;
+            for (int i = 0; i < options.batch; ++i) {
+                completed += jobs[i].completed ? 1 : 0;
             }
+            LOG_INFO("[D] Batch: " << completed << "/" << options.batch << " jobs, " << stats.threads << " threads, "
+                << stats.images << " images, " << stats.steals << " steals, " << stats.instructions << " instructions in "
+                << stats.seconds << "s");
         }
 
-        char* bytecode_ptr = (char*)asm_malloc(stream_ptr->length);
-        memcpy(bytecode_ptr, stream_ptr->get(), stream_ptr->length);
-
-        registers[PC] = asm_maddrof(bytecode_ptr);
-        registers[PX] = (registers[PC] + stream_ptr->length);
-        this->info->program_counter_lower_bound = registers[PC];
-        this->info->program_counter_higher_bound = registers[PX]; 
-
-        LOG_MSG("[+] Initialized bytecode (" << program->length << " instructions written)");
-        free(stream_ptr);
-    }
-
-
-    void initialize(op_program_t* program) { 
-        this->program = program;
-        this->info = (cpu_info_t*)malloc(sizeof(cpu_info_t));
-        memset(this->info, 0, sizeof(cpu_info_t));
-
-        initialize_memory();
-        initialize_registers();
-        initialize_bytecode();
-    }
-
-    template<typename T> T get_operand(const unsigned char* bytecode, size_t& pc) {
-        T operand;
-        memcpy(&operand, &bytecode[pc], sizeof(T));
-        pc += sizeof(T);
-        return operand;
-    }
-
-    void validate() {
-        if (registers[SP] > STACK_SIZE)
-            throw std::runtime_error("Register 'SP' (Stack Pointer) is out of bounds. The max size is 1024.");
+        free(jobs);
+        free_program(program_ptr);
+        free_assembly(assembly);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    
-    // execute() and execute_inst() should be tied together
-    // meaning that execute_inst() should be able to control
-    // the next location of memory to execute, whereas now it can
-    // only execute each memory code sequentially.
-    // 
-    // this can be catastropic because it will also attempt
-    // to execute operands as opcodes. not good :(
-    // FIXED: 09/01/2025 nexusverypro
-    // FIXME(FIXED): still not working? 10/01/2025 nexusverypro
-    void execute_inst(binaryp_t* stream) {
-        validate(); // validate our cpu
-
-        this->info->total_run_cycles++;
-        registers[PC] = this->info->program_counter_lower_bound + stream->position;
-
-        unsigned char op_code = stream->read_uint8();
-        const int length = stream->read_int32();
-
-        // validate that we are still in bounds
-        if (registers[PC] >= std::min(registers[PX], this->info->program_counter_higher_bound))
-            return;
-        LOG_MSG("[+] -> Executing opcode: " << (int)op_code);
-
-        switch (op_code) {
-            case PUSH: {
-                if (length == 1) {
-                    int value = stream->read_int32();
-                    asm_stack_push(value);
-                }
-                break;
-            }
-
-            case POP: {
-                if (length == 1) {
-                    int registerIdx = stream->read_int32();
-                    int value = asm_stack_pop();
-                    registers[registerIdx] = value;
-                }
-                break;
-            }
-
-            case ADD: {
-                if (length == 2) {
-                    int lhsRegisterIdx = stream->read_int32();
-                    int rhsRegisterIdx = stream->read_int32();
-
-                    int value = registers[lhsRegisterIdx] + registers[rhsRegisterIdx];
-                    registers[lhsRegisterIdx] = value;
-                }
-                break;
-            }
-
-            case SUB: {
-                if (length == 2) {
-                    int lhsRegisterIdx = stream->read_int32();
-                    int rhsRegisterIdx = stream->read_int32();
-
-                    int value = registers[lhsRegisterIdx] - registers[rhsRegisterIdx];
-                    registers[lhsRegisterIdx] = value;
-                }
-                break;
-            }
-
-            case MUL: {
-                if (length == 2) {
-                    int lhsRegisterIdx = stream->read_int32();
-                    int rhsRegisterIdx = stream->read_int32();
-
-                    int value = registers[lhsRegisterIdx] * registers[rhsRegisterIdx];
-                    registers[lhsRegisterIdx] = value;
-                }
-                break;
-            }
-
-            case DIV: {
-                if (length == 2) {
-                    int lhsRegisterIdx = stream->read_int32();
-                    int rhsRegisterIdx = stream->read_int32();
-
-                    int value = registers[lhsRegisterIdx] / registers[rhsRegisterIdx];
-                    registers[lhsRegisterIdx] = value;
-                }
-                break;
-            }
-
-            case OR: {
-                if (length == 2) {
-                    int lhsRegisterIdx = stream->read_int32();
-                    int rhsRegisterIdx = stream->read_int32();
-
-                    int value = registers[lhsRegisterIdx] | registers[rhsRegisterIdx];
-                    registers[lhsRegisterIdx] = value;
-                }
-                break;
-            }
 
-            case XOR: {
-                if (length == 2) {
-                    int lhsRegisterIdx = stream->read_int32();
-                    int rhsRegisterIdx = stream->read_int32();
-                    
-                    int value = registers[lhsRegisterIdx] ^ registers[rhsRegisterIdx];
-                    registers[lhsRegisterIdx] = value;
-                }
-                break;
-            }
-
-            case JMP: {
-                if (length == 1) {
-                    int jumpLabelIdx = stream->read_int32();
-                    if (jumpLabelIdx >= 0 && jumpLabelIdx <= (this->info->program_counter_higher_bound - this->info->program_counter_lower_bound)) {
-                        stream->position = jumpLabelIdx;
-                    }
-                }
-                break;
-            }
-
-            default: {
-                LOG_MSG("[-] -> Unknown opcode: " << (int)op_code);
-                break;
-            }
-        }
-    }
-
-    void execute() {
-        binaryp_t* stream_ptr = create_binary_stream(true);
-        if (stream_ptr == NULL) {
-            LOG_MSG("[D] Failed to create binary stream");
-            return;
-        }
-
-        stream_ptr->append(
-            (unsigned char*)&memory[registers[PC]],
-            registers[PX] - registers[PC]
-        );
-        stream_ptr->reset();
-        stream_ptr->can_write = false;
-
-        // TODO(FIXED): loop immedately ends because PC is greater than
-        // PX. might be a syncronization issue, because PC is always
-        // memory space. PC is supposed to be the index of memory
-        // while PX is supposed to be the length of total bytes.
-        // FIXED: 10/01/2025 nexusverypro
-        while (true) {
-            if (registers[PC] >= std::min(registers[PX], this->info->program_counter_higher_bound)) {
-                LOG_MSG("[+] Program execution complete: " << this->info->total_run_cycles << " total cycles");
-                break;
-            }
-
-            execute_inst(stream_ptr);
+    bytecode_file_t* file = NULL;
+    if (options.load_path != NULL) {
+        file = load_bytecode_file(options.load_path);
+        if (file == NULL) {
+            free_program(program_ptr);
+            free_assembly(assembly);
+            return EXIT_FAILURE;
         }
-
-        free(stream_ptr);
-    }
-};
-
-int main(int argc, char* argv[]) {
-    auto program_ptr = create_program();
-
-    // PUSH 0x01 (int)
-    {
-        int* operands = (int*)malloc(sizeof(int) * 1);
-        operands[0] = 25;
-        size_t* sizes = (size_t*)malloc(sizeof(size_t) * 1);
-        sizes[0] = sizeof(int);
-        add_instruction(program_ptr, PUSH, 1, sizes, operands);
-    }
-
-    // POP r5
-    {
-        int* operands = (int*)malloc(sizeof(int) * 1);
-        operands[0] = R5;
-        size_t* sizes = (size_t*)malloc(sizeof(size_t) * 1);
-        sizes[0] = sizeof(int);
-        add_instruction(program_ptr, POP, 1, sizes, operands);
-    }
-
-    // INT 21h
-    {
-        int* operands = (int*)malloc(sizeof(int) * 1);
-        operands[0] = 0x21;
-        size_t* sizes = (size_t*)malloc(sizeof(size_t) * 1);
-        sizes[0] = sizeof(int);
-        add_instruction(program_ptr, INT, 1, sizes, operands);
     }
 
     auto cpu = (cpu_t*)malloc(sizeof(cpu_t));
-    cpu->initialize(program_ptr);
-    cpu->execute();
-
+    const bool loaded = file != NULL ? cpu->initialize(file, options.memory_size)
+                                     : cpu->initialize(program_ptr, options.memory_size);
+    if (!loaded) {
+        cpu->release();
+        free(cpu);
+        free_bytecode_file(file);
+        free_program(program_ptr);
+        free_assembly(assembly);
+        return EXIT_FAILURE;
+    }
+    cpu->engine = options.engine;
+    if (options.profile) {
+        cpu->enable_profile(options.profile_json);
+    }
+    if (options.budget > 0) {
+        if (cpu->run_for(options.budget) == CPU_YIELDED) {
+            LOG_WARN("[!] Program stopped after " << cpu->info->total_run_cycles << " instructions (--budget=" << options.budget << ")");
+        }
+    } else {
+        cpu->execute();
+    }
+    cpu->release();
+
+    if (options.trace_dump != NULL) {
+        trace_dump(options.trace_dump);
+    } else if (options.trace) {
+        trace_print();
+    }
+
+    free(cpu);
+    free_bytecode_file(file);
+    free_program(program_ptr);
+    free_assembly(assembly);
     return EXIT_FAILURE;
 }
\ No newline at end of file
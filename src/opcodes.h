@@ -13,19 +13,89 @@ typedef enum op_type_t : unsigned char {
   OR      = 0x07,
   XOR     = 0x08,
   AND     = 0x09,
-  CMP     = 0x0A,
+  CMP     = 0x0A,                           // sets ZF/SF from reg - reg
   JMP     = 0x0B,
-  JE      = 0x0C,
-  JNE     = 0x0D, 
+  JE      = 0x0C,                           // jumps if ZF is set
+  JNE     = 0x0D,                           // jumps if ZF is clear
   INT     = 0x0E,                           // Interrupt
-};
 
-typedef struct op_inst_t {
-  int index;
-  unsigned char type;
-  int length;
-  size_t* sizes;
-  void* operands;
+  // superinstructions, emitted by optimize_program()
+  MOVI    = 0x10,                           // reg = imm (fused PUSH imm; POP reg)
+
+  // register-immediate ALU, reg = reg op imm
+  ADDI    = 0x11,
+  SUBI    = 0x12,
+  MULI    = 0x13,
+  DIVI    = 0x14,                           // unsigned, like DIV. an immediate 0 is rejected
+  ANDI    = 0x15,
+  ORI     = 0x16,
+  XORI    = 0x17,
+
+  // a word of guest memory at [base reg + offset], operands are reg, base reg, offset
+  LOAD    = 0x18,                           // reg = [base + offset]
+  STORE   = 0x19,                           // [base + offset] = reg
+
+  // fused CMP reg, reg; JE/JNE target, emitted by optimize_program()
+  CMPJE   = 0x1A,
+  CMPJNE  = 0x1B,
 };
 
+inline const char* op_name(unsigned char type) {
+  switch (type) {
+    case PUSH: return "PUSH";
+    case POP:  return "POP";
+    case ADD:  return "ADD";
+    case SUB:  return "SUB";
+    case MUL:  return "MUL";
+    case DIV:  return "DIV";
+    case OR:   return "OR";
+    case XOR:  return "XOR";
+    case AND:  return "AND";
+    case CMP:  return "CMP";
+    case JMP:  return "JMP";
+    case JE:   return "JE";
+    case JNE:  return "JNE";
+    case INT:  return "INT";
+    case MOVI: return "MOVI";
+    case ADDI: return "ADDI";
+    case SUBI: return "SUBI";
+    case MULI: return "MULI";
+    case DIVI: return "DIVI";
+    case ANDI: return "ANDI";
+    case ORI:  return "ORI";
+    case XORI: return "XORI";
+    case LOAD: return "LOAD";
+    case STORE: return "STORE";
+    case CMPJE: return "CMPJE";
+    case CMPJNE: return "CMPJNE";
+  }
+  return "???";
+}
+
+// which operand of a jump holds its target (a byte offset into the bytecode),
+// -1 for everything that isn't one. the target is always the last operand
+inline int jump_operand(unsigned char type) {
+  switch (type) {
+    case JMP:
+    case JE:
+    case JNE:    return 0;
+    case CMPJE:
+    case CMPJNE: return 2;
+  }
+  return -1;
+}
+
+// how many leading operands index the registers
+inline int register_operands(unsigned char type) {
+  switch (type) {
+    case POP:  case MOVI:
+    case ADDI: case SUBI: case MULI: case DIVI: case ANDI: case ORI: case XORI:
+      return 1;
+    case ADD:  case SUB:  case MUL:  case DIV:  case AND:  case OR:  case XOR:
+    case CMP:  case LOAD: case STORE: case CMPJE: case CMPJNE:
+      return 2;
+  }
+  return 0;
+}
+
 #endif // __OPCODES_H__
\ No newline at end of file
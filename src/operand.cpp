@@ -1,102 +1,223 @@
 #include "operand.h"
+#include "machine.h"
 
-// 20
-void* get_operand_from_int(char* str) {
-    int* operand = (int*)malloc(sizeof(int));
-    memset(operand, 0, sizeof(int));
+static bool fail(operand_t* out) {
+    out->type = OPERAND_NONE;
+    out->value = 0;
+    out->offset = 0;
+    out->text = NULL;
+    out->length = 0;
+    return false;
+}
 
-    *operand = std::stoi(str);
-    return operand;
+static bool set(operand_t* out, operand_type_t type, int value) {
+    out->type = type;
+    out->value = value;
+    out->offset = 0;
+    out->text = NULL;
+    out->length = 0;
+    return true;
 }
 
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
-// 0x33, 21h
-void* get_operand_from_hex(char* str) {
-    int* operand = (int*)malloc(sizeof(int));
-    memset(operand, 0, sizeof(int));
-    
-    if (str == NULL || *str == '\0') {
-        return operand;
+// 'a', '\n'
+static bool parse_char(const char* str, size_t length, operand_t* out) {
+    if (length == 3 && str[2] == '\'' && str[1] != '\\') {
+        return set(out, OPERAND_INT, (unsigned char)str[1]);
+    }
+    if (length != 4 || str[1] != '\\' || str[3] != '\'') {
+        return fail(out);
     }
 
-    while (*str && isspace(*str)) {
-        str++;
+    switch (str[2]) {
+        case 'n':  return set(out, OPERAND_INT, '\n');
+        case 't':  return set(out, OPERAND_INT, '\t');
+        case 'r':  return set(out, OPERAND_INT, '\r');
+        case '0':  return set(out, OPERAND_INT, '\0');
+        case '\\': return set(out, OPERAND_INT, '\\');
+        case '\'': return set(out, OPERAND_INT, '\'');
+    }
+    return fail(out);
+}
+
+// 20, -3, 'h'. anything from INT_MIN up to UINT_MAX is accepted, the
+// upper half wraps around like it would in a 32-bit register.
+bool get_operand_from_int(const char* str, size_t length, operand_t* out) {
+    if (length == 0) {
+        return fail(out);
+    }
+    if (str[0] == '\'') {
+        return parse_char(str, length, out);
     }
 
-    int base = 16;
-    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
-        str += 2;
+    size_t i = 0;
+    const bool negative = str[0] == '-';
+    if (str[0] == '-' || str[0] == '+') {
+        i++;
+    }
+    if (i == length) {
+        return fail(out);
+    }
+
+    unsigned long long value = 0;
+    for (; i < length; ++i) {
+        const unsigned int digit = (unsigned int)(str[i] - '0');
+        if (digit > 9) {
+            return fail(out);
+        }
+        value = value * 10 + digit;
+        if (value > 0xFFFFFFFFull) {
+            return fail(out);
+        }
+    }
+
+    if (negative && value > 0x80000000ull) {
+        return fail(out);
+    }
+    return set(out, OPERAND_INT, negative ? (int)(0u - (unsigned int)value) : (int)(unsigned int)value);
+}
+
+// 0x33, 21h. without either marker the text is read as decimal
+bool get_operand_from_hex(const char* str, size_t length, operand_t* out) {
+    size_t start = 0;
+    size_t end = length;
+    if (length > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        start = 2;
+    } else if (length > 1 && (str[length - 1] == 'h' || str[length - 1] == 'H')) {
+        end = length - 1;
+    } else if (!get_operand_from_int(str, length, out)) {
+        return false;
     } else {
-        char* h_pos = strchr(str, 'h');
-        if (h_pos != NULL) {
-            *h_pos = '\0';
-        } else base = 10;
+        out->type = OPERAND_HEX;
+        return true;
     }
 
-    char* endptr;
-    long value = strtol(str, &endptr, base);
-    if (endptr == str || (endptr != NULL && *endptr != '\0' && !isspace(*endptr))) {
-        *operand = 0;
-    } else *operand = (int)value;
+    if (end - start > 8) {
+        return fail(out);
+    }
 
-    return operand;
+    unsigned int value = 0;
+    for (size_t i = start; i < end; ++i) {
+        const int digit = hex_digit(str[i]);
+        if (digit < 0) {
+            return fail(out);
+        }
+        value = (value << 4) | (unsigned int)digit;
+    }
+    return set(out, OPERAND_HEX, (int)value);
 }
 
 // "hello, world!"
-void* get_operand_from_string(char* str) {
-    if (str == NULL || *str == '\0') {
-        return NULL;
-    }
-    
-    size_t len = strlen(str);
-    if (str[0] == '"' && str[len-1] == '"') {
-        str[len-1] = '\0';
+bool get_operand_from_string(const char* str, size_t length, operand_t* out) {
+    if (length < 2 || str[0] != '"' || str[length - 1] != '"') {
+        return fail(out);
+    }
+
+    out->type = OPERAND_STRING;
+    out->value = 0;
+    out->offset = 0;
+    out->text = str + 1;
+    out->length = length - 2;
+    return true;
+}
+
+typedef struct register_name_t {
+  const char* name;
+  int id;
+};
+
+// the eax..edx names are what this parser understood before the cpu had
+// numbered registers, they alias r0..r3
+static constexpr register_name_t register_names[] = {
+    { "r0", R0 }, { "r1", R1 }, { "r2", R2 }, { "r3", R3 }, { "r4", R4 },
+    { "r5", R5 }, { "r6", R6 }, { "r7", R7 }, { "r8", R8 },
+    { "pc", PC }, { "sp", SP }, { "px", PX }, { "zf", ZF }, { "sf", SF },
+    { "eax", R0 }, { "ebx", R1 }, { "ecx", R2 }, { "edx", R3 },
+};
+
+// %eax, r5, SP
+bool get_operand_from_register(const char* str, size_t length, operand_t* out) {
+    if (length > 0 && str[0] == '%') {
         str++;
+        length--;
+    }
+    if (length < 2 || length > 3) {
+        return fail(out);
+    }
+
+    char name[4] = {};
+    for (size_t i = 0; i < length; ++i) {
+        name[i] = (char)(str[i] | 0x20);                // ascii lowercase, digits are unaffected
+    }
+
+    for (const register_name_t& reg : register_names) {
+        if (strcmp(name, reg.name) == 0) {
+            return set(out, OPERAND_REGISTER, reg.id);
+        }
     }
-    
-    char* operand = (char*)malloc(strlen(str) + 1);
-    strcpy(operand, str);
-    return operand;
+    return fail(out);
 }
 
-// %eax
-void* get_operand_from_register(char* str) {
-    int* operand = (int*)malloc(sizeof(int));
-    memset(operand, 0, sizeof(int));
-    
-    if (str[0] == '%') str++;
-
-    if (strcmp(str, "eax") == 0) *operand = 0;
-    else if (strcmp(str, "ebx") == 0) *operand = 1;
-    else if (strcmp(str, "ecx") == 0) *operand = 2;
-    else if (strcmp(str, "edx") == 0) *operand = 3;
-    else *operand = -1;
-    
-    return operand;
+static void trim(const char* str, size_t* start, size_t* end) {
+    while (*start < *end && isspace((unsigned char)str[*start])) (*start)++;
+    while (*end > *start && isspace((unsigned char)str[*end - 1])) (*end)--;
 }
 
-// [eax]
-void* get_operand_from_memory(char* str) {
-    int* operand = (int*)malloc(sizeof(int));
-    memset(operand, 0, sizeof(int));
-    
-    str++;
-    str[strlen(str)-1] = '\0';
-    void* reg = get_operand_from_register(str);
-    *operand = *(int*)reg;
-    free(reg);
-    
-    return operand;
+// [eax], [r1 + 8], [sp - 0x10]. the offset is any immediate get_operand_from_hex() takes
+bool get_operand_from_memory(const char* str, size_t length, operand_t* out) {
+    if (length < 3 || str[0] != '[' || str[length - 1] != ']') {
+        return fail(out);
+    }
+
+    size_t start = 1;
+    size_t end = length - 1;
+    trim(str, &start, &end);
+
+    size_t sign = start;
+    while (sign < end && str[sign] != '+' && str[sign] != '-') sign++;
+
+    size_t register_end = sign;
+    trim(str, &start, &register_end);
+    if (!get_operand_from_register(str + start, register_end - start, out)) {
+        return false;
+    }
+    const int base = out->value;
+
+    int offset = 0;
+    if (sign < end) {
+        size_t offset_start = sign + 1;
+        trim(str, &offset_start, &end);
+        if (offset_start == end || str[offset_start] == '+' || str[offset_start] == '-' ||
+            !get_operand_from_hex(str + offset_start, end - offset_start, out)) {
+            return fail(out);
+        }
+        offset = str[sign] == '-' ? (int)(0u - (unsigned int)out->value) : out->value;
+    }
+
+    set(out, OPERAND_MEMORY, base);
+    out->offset = offset;
+    return true;
 }
 
-void* get_operand_from_auto(char* str) {
-    if (str[0] == '"') {
-        return get_operand_from_string(str);
+bool get_operand_from_auto(const char* str, size_t length, operand_t* out) {
+    if (length == 0) {
+        return fail(out);
+    } else if (str[0] == '"') {
+        return get_operand_from_string(str, length, out);
     } else if (str[0] == '[') {
-        return get_operand_from_memory(str);
-    } else if (str[0] == '%' || isalpha(str[0])) {
-        return get_operand_from_register(str);
-    } else if ((str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) || str[strlen(str) - 1] == 'h') {
-        return get_operand_from_hex(str);
-    } else return get_operand_from_int(str);
-}
\ No newline at end of file
+        return get_operand_from_memory(str, length, out);
+    } else if (str[0] == '%' || isalpha((unsigned char)str[0])) {
+        return get_operand_from_register(str, length, out);
+    } else if (str[0] == '\'') {
+        return get_operand_from_int(str, length, out);
+    } else if ((length > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) ||
+               str[length - 1] == 'h' || str[length - 1] == 'H') {
+        return get_operand_from_hex(str, length, out);
+    } else return get_operand_from_int(str, length, out);
+}
@@ -4,21 +4,35 @@
 #include "stdafx.h"
 #include "log.h"
 
+// prefixed so they don't collide with op_type_t (INT is also an opcode)
 typedef enum operand_type_t : unsigned char {
-    INT         = 0x00,
-    HEX         = 0x01,
-    STRING      = 0x02,
-    REGISTER    = 0x03,
-    MEMORY      = 0x04,
+    OPERAND_INT         = 0x00,
+    OPERAND_HEX         = 0x01,
+    OPERAND_STRING      = 0x02,
+    OPERAND_REGISTER    = 0x03,
+    OPERAND_MEMORY      = 0x04,
 
-    NONE        = 0xFF,
+    OPERAND_NONE        = 0xFF,
 };
 
-void* get_operand_from_int(char* str);                          // 20, 'h'
-void* get_operand_from_hex(char* str);                          // 0x21, 21h
-void* get_operand_from_string(char* str);                       // "hello world"
-void* get_operand_from_register(char* str);                     // %eax
-void* get_operand_from_memory(char* str);                       // [eax]
-void* get_operand_from_auto(char* str);
+// a parsed operand. nothing is allocated, a string operand points back into
+// the text it was parsed from (between the quotes, escapes are left as is).
+typedef struct operand_t {
+  operand_type_t type;
+  int value;                                // number, or register id for register/memory operands
+  int offset;                               // memory operands, the 8 in [r0 + 8]
+  const char* text;
+  size_t length;
+};
+
+// every parser takes [str, str + length) with surrounding whitespace already
+// trimmed, doesn't need it to be nul-terminated and never writes to it.
+// they return false (and leave 'out' as OPERAND_NONE) on anything malformed.
+bool get_operand_from_int(const char* str, size_t length, operand_t* out);         // 20, -3, 'h'
+bool get_operand_from_hex(const char* str, size_t length, operand_t* out);         // 0x21, 21h
+bool get_operand_from_string(const char* str, size_t length, operand_t* out);      // "hello world"
+bool get_operand_from_register(const char* str, size_t length, operand_t* out);    // r0, %r0, sp, %eax
+bool get_operand_from_memory(const char* str, size_t length, operand_t* out);      // [r0], [r0 + 8], [sp - 4]
+bool get_operand_from_auto(const char* str, size_t length, operand_t* out);
 
-#endif // __OPERAND_H__
\ No newline at end of file
+#endif // __OPERAND_H__
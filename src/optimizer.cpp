@@ -0,0 +1,167 @@
+#include "optimizer.h"
+
+static constexpr int INSTRUCTION_HEADER_SIZE = sizeof(unsigned char) + sizeof(int);
+
+static int byte_offset_of(const op_program_t* program, int idx) {
+    return idx * INSTRUCTION_HEADER_SIZE + program->offsets[idx];
+}
+
+// byte offset -> instruction index, -1 if it doesn't land on a boundary.
+// the end of the program resolves to 'length'.
+static int index_of_offset(const op_program_t* program, int offset) {
+    int lo = 0;
+    int hi = program->length;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int mid_offset = byte_offset_of(program, mid);
+        if (mid_offset == offset) return mid;
+        if (mid_offset < offset) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+// any jump with its target operand where it belongs
+static bool is_jump(const op_program_t* program, int idx) {
+    const int operand = jump_operand(program->types[idx]);
+    return operand >= 0 && program->lengths[idx] == operand + 1;
+}
+
+static bool is_unconditional_jump(const op_program_t* program, int idx) {
+    return program->types[idx] == JMP && program->lengths[idx] == 1;
+}
+
+op_program_t* optimize_program(const op_program_t* program, optimize_report_t* report, int* index_map) {
+    memset(report, 0, sizeof(optimize_report_t));
+    report->input_length = program->length;
+
+    const int length = program->length;
+    int* targets = (int*)malloc(sizeof(int) * (length + 1));            // resolved target of every jump, -1 otherwise
+    bool* is_target = (bool*)calloc(length + 1, sizeof(bool));
+    int* new_index = (int*)malloc(sizeof(int) * (length + 1));
+    int* kept_jumps = (int*)malloc(sizeof(int) * (length + 1));           // input index of every jump that made it through
+    if (targets == NULL || is_target == NULL || new_index == NULL || kept_jumps == NULL) {
+        LOG_ERROR("[-] optimize_program() failed to allocate its tables, program left unoptimized");
+        free(kept_jumps);
+        free(targets);
+        free(is_target);
+        free(new_index);
+        report->output_length = length;
+        return NULL;
+    }
+
+    for (int i = 0; i < length; ++i) {
+        targets[i] = is_jump(program, i) ? index_of_offset(program, program->operand_int(i, jump_operand(program->types[i]))) : -1;
+    }
+
+    // thread jump -> JMP chains, bounded so a jump cycle can't spin forever.
+    // a conditional jump can be skipped over only when it's the source
+    for (int i = 0; i < length; ++i) {
+        if (targets[i] < 0)
+            continue;
+
+        int target = targets[i];
+        for (int hops = 0; hops < length && target < length && is_unconditional_jump(program, target) &&
+                           targets[target] >= 0 && targets[target] != target; ++hops) {
+            target = targets[target];
+        }
+
+        if (target != targets[i]) {
+            targets[i] = target;
+            report->threaded_jumps++;
+        }
+    }
+
+    for (int i = 0; i < length; ++i) {
+        if (targets[i] >= 0) {
+            is_target[targets[i]] = true;
+        }
+    }
+
+    op_program_t* optimized = create_program();
+    int kept_jump_count = 0;
+    bool appended = true;
+
+    for (int i = 0; appended && i < length; ) {
+        new_index[i] = optimized->length;
+        const unsigned char type = program->types[i];
+
+        // a jump to the next instruction does nothing
+        if (is_unconditional_jump(program, i) && targets[i] == i + 1) {
+            report->removed_jumps++;
+            i++;
+            continue;
+        }
+
+        // PUSH imm; POP reg
+        if (type == PUSH && program->lengths[i] == 1 && i + 1 < length && !is_target[i + 1] &&
+            program->types[i + 1] == POP && program->lengths[i + 1] == 1) {
+            int operands[] = { program->operand_int(i + 1, 0), program->operand_int(i, 0) };
+            appended = append_instruction(optimized, MOVI, 2, operands, sizeof(operands));
+            new_index[i + 1] = new_index[i];
+            report->fused_movi++;
+            i += 2;
+            continue;
+        }
+
+        // CMP reg, reg; JE/JNE target, the target operand is patched below like any jump's
+        if (type == CMP && program->lengths[i] == 2 && i + 1 < length && !is_target[i + 1] &&
+            is_jump(program, i + 1) && (program->types[i + 1] == JE || program->types[i + 1] == JNE)) {
+            int operands[] = { program->operand_int(i, 0), program->operand_int(i, 1), -1 };
+            appended = append_instruction(optimized, program->types[i + 1] == JE ? CMPJE : CMPJNE, 3, operands, sizeof(operands));
+            new_index[i + 1] = new_index[i];
+            kept_jumps[kept_jump_count++] = i + 1;
+            report->fused_branches++;
+            i += 2;
+            continue;
+        }
+
+        if (is_jump(program, i)) {
+            kept_jumps[kept_jump_count++] = i;
+        }
+        appended = append_instruction(optimized, type, program->lengths[i], program->operands_of(i), program->operands_size(i));
+        i++;
+    }
+    new_index[length] = optimized->length;
+
+    // a program missing instructions is worse than an unoptimized one
+    if (!appended) {
+        LOG_ERROR("[-] optimize_program() ran out of memory, program left unoptimized");
+        free_program(optimized);
+        free(kept_jumps);
+        free(targets);
+        free(is_target);
+        free(new_index);
+        report->output_length = length;
+        return NULL;
+    }
+
+    // byte offsets moved, point every jump at its (possibly threaded) target again.
+    // jumps that never hit an instruction boundary get an offset no engine accepts
+    for (int i = 0; i < kept_jump_count; ++i) {
+        const int source = kept_jumps[i];
+        const int jump = new_index[source];
+        const int target = targets[source] >= 0 ? byte_offset_of(optimized, new_index[targets[source]]) : -1;
+        const size_t at = optimized->offsets[jump] + (size_t)jump_operand(optimized->types[jump]) * sizeof(int);
+        memcpy(&optimized->operands[at], &target, sizeof(int));
+    }
+
+    if (index_map != NULL) {
+        memcpy(index_map, new_index, sizeof(int) * (length + 1));
+    }
+
+    free(kept_jumps);
+    free(targets);
+    free(is_target);
+    free(new_index);
+    report->output_length = optimized->length;
+    return optimized;
+}
+
+void print_optimize_report(const optimize_report_t* report) {
+    LOG_MSG("[+] Optimized program: " << report->input_length << " -> " << report->output_length << " instructions");
+    LOG_MSG("    MOVI (PUSH imm; POP reg) : " << report->fused_movi);
+    LOG_MSG("    CMP; JE/JNE -> CMPJE/JNE : " << report->fused_branches);
+    LOG_MSG("    threaded jumps           : " << report->threaded_jumps);
+    LOG_MSG("    removed jumps            : " << report->removed_jumps);
+}
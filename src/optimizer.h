@@ -0,0 +1,27 @@
+#ifndef __OPTIMIZER_H__
+#define __OPTIMIZER_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "opcodes.h"
+#include "ilbuilder.h"
+
+typedef struct optimize_report_t {
+  int input_length;
+  int output_length;
+  int fused_movi;                           // PUSH imm; POP reg -> MOVI reg, imm
+  int fused_branches;                       // CMP reg, reg; JE/JNE -> CMPJE/CMPJNE
+  int threaded_jumps;                       // jump to a JMP retargeted to the final destination
+  int removed_jumps;                        // JMP to the very next instruction
+};
+
+// peephole pass over a program, run before cpu_t::initialize(). returns a new
+// program (the input is left untouched) with every jump operand rewritten to
+// the new byte offsets. an instruction that is a jump target is never fused
+// with the one before it. 'index_map' (length + 1 entries), if given, receives
+// the new index of every input instruction, e.g. to move labels along.
+// NULL (logged) if it runs out of memory, the input is then run as is.
+op_program_t* optimize_program(const op_program_t* program, optimize_report_t* report, int* index_map = NULL);
+void print_optimize_report(const optimize_report_t* report);
+
+#endif // __OPTIMIZER_H__
\ No newline at end of file
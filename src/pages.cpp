@@ -0,0 +1,172 @@
+#include "pages.h"
+
+size_t page_align(size_t size) {
+    return (size + MEMORY_PAGE_SIZE - 1) & ~(size_t)(MEMORY_PAGE_SIZE - 1);
+}
+
+static bool is_zero_page(const unsigned char* page) {
+    const unsigned long long* words = (const unsigned long long*)page;
+    for (size_t i = 0; i < MEMORY_PAGE_SIZE / sizeof(unsigned long long); ++i) {
+        if (words[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+#if CEMU_HAS_COW
+#include <sys/mman.h>
+#include <unistd.h>
+
+unsigned char* map_pages(size_t size, const page_image_t* image) {
+    // nothing is reserved up front, the kernel backs a page on first touch
+    void* pages = image != NULL
+        ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, image->fd, 0)
+        : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pages == MAP_FAILED) {
+        LOG_ERROR("[-] Failed to map " << size << " bytes of guest memory");
+        return NULL;
+    }
+    return (unsigned char*)pages;
+}
+
+bool remap_pages(unsigned char* pages, size_t size, const page_image_t* image) {
+    // MAP_FIXED over the old mapping throws away its private (written) pages
+    void* mapped = image != NULL
+        ? mmap(pages, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, image->fd, 0)
+        : mmap(pages, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR("[-] Failed to remap guest memory");
+        return false;
+    }
+    return true;
+}
+
+void unmap_pages(unsigned char* pages, size_t size) {
+    if (pages == NULL)
+        return;
+
+    munmap(pages, size);
+}
+
+bool map_file_pages(unsigned char* pages, size_t size, int fd, size_t offset, const unsigned char* data) {
+    if (fd < 0) {
+        memcpy(pages, data, size);
+        return true;
+    }
+
+    void* mapped = mmap(pages, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)offset);
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR("[-] Failed to map file into guest memory");
+        return false;
+    }
+    return true;
+}
+
+page_image_t* create_page_image(const unsigned char* pages, size_t size) {
+    const int fd = memfd_create("cemu-snapshot", MFD_CLOEXEC);
+    if (fd < 0) {
+        LOG_ERROR("[-] memfd_create() failed for snapshot");
+        return NULL;
+    }
+
+    if (ftruncate(fd, (off_t)size) != 0) {
+        LOG_ERROR("[-] Failed to size snapshot image");
+        close(fd);
+        return NULL;
+    }
+
+    // the file starts out as one big hole, only pages with data are written
+    for (size_t offset = 0; offset < size; offset += MEMORY_PAGE_SIZE) {
+        if (is_zero_page(pages + offset))
+            continue;
+
+        if (pwrite(fd, pages + offset, MEMORY_PAGE_SIZE, (off_t)offset) != MEMORY_PAGE_SIZE) {
+            LOG_ERROR("[-] Failed to write snapshot image");
+            close(fd);
+            return NULL;
+        }
+    }
+
+    page_image_t* image = (page_image_t*)malloc(sizeof(page_image_t));
+    if (image == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for page_image_t");
+        close(fd);
+        return NULL;
+    }
+
+    image->fd = fd;
+    image->data = NULL;
+    image->size = size;
+    return image;
+}
+
+void free_page_image(page_image_t* image) {
+    if (image == NULL)
+        return;
+
+    close(image->fd);
+    free(image);
+}
+
+#else
+
+unsigned char* map_pages(size_t size, const page_image_t* image) {
+    unsigned char* pages = (unsigned char*)calloc(1, size);
+    if (pages == NULL) {
+        LOG_ERROR("[-] Failed to allocate " << size << " bytes of guest memory");
+        return NULL;
+    }
+
+    if (image != NULL) {
+        memcpy(pages, image->data, size);
+    }
+    return pages;
+}
+
+bool remap_pages(unsigned char* pages, size_t size, const page_image_t* image) {
+    if (image != NULL) {
+        memcpy(pages, image->data, size);
+    } else {
+        memset(pages, 0, size);
+    }
+    return true;
+}
+
+void unmap_pages(unsigned char* pages, size_t size) {
+    free(pages);
+}
+
+bool map_file_pages(unsigned char* pages, size_t size, int fd, size_t offset, const unsigned char* data) {
+    memcpy(pages, data, size);
+    return true;
+}
+
+page_image_t* create_page_image(const unsigned char* pages, size_t size) {
+    page_image_t* image = (page_image_t*)malloc(sizeof(page_image_t));
+    if (image == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for page_image_t");
+        return NULL;
+    }
+
+    image->fd = -1;
+    image->size = size;
+    image->data = (unsigned char*)malloc(size);
+    if (image->data == NULL) {
+        LOG_ERROR("[-] Failed to allocate snapshot image");
+        free(image);
+        return NULL;
+    }
+
+    memcpy(image->data, pages, size);
+    return image;
+}
+
+void free_page_image(page_image_t* image) {
+    if (image == NULL)
+        return;
+
+    free(image->data);
+    free(image);
+}
+
+#endif
\ No newline at end of file
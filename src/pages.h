@@ -0,0 +1,43 @@
+#ifndef __PAGES_H__
+#define __PAGES_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "machine.h"
+
+// every cpu gets one mapping holding its guest memory followed by the heap's
+// side tables. pages are only backed once touched, so a large address space
+// costs what the guest uses, and the mapping can be a private copy-on-write
+// view of a snapshot image, sharing every untouched page with the snapshot
+// and all the other cpus forked from it. that needs memfd_create(), so only
+// on linux, everything else gets calloc'd memory and full copies.
+#if defined(__linux__)
+#define CEMU_HAS_COW 1
+#else
+#define CEMU_HAS_COW 0
+#endif
+
+// frozen copy of a cpu's mapping, all-zero pages are left as holes
+typedef struct page_image_t {
+  int fd;                                   // memfd holding the image, -1 without cow
+  unsigned char* data;                      // the image itself without cow, NULL with it
+  size_t size;
+};
+
+// rounds up to whole MEMORY_PAGE_SIZE pages
+size_t page_align(size_t size);
+
+// 'size' zeroed bytes, or a private view of 'image' when it isn't NULL
+unsigned char* map_pages(size_t size, const page_image_t* image);
+// drops every page written since and puts back 'image' (or zeroes) in place
+bool remap_pages(unsigned char* pages, size_t size, const page_image_t* image);
+void unmap_pages(unsigned char* pages, size_t size);
+// puts 'size' bytes of a file (starting at the page aligned 'offset') over
+// 'pages' as a private copy-on-write view, so they come from the page cache.
+// 'data' is the same bytes in memory, copied instead when there is no fd.
+bool map_file_pages(unsigned char* pages, size_t size, int fd, size_t offset, const unsigned char* data);
+
+page_image_t* create_page_image(const unsigned char* pages, size_t size);
+void free_page_image(page_image_t* image);
+
+#endif // __PAGES_H__
\ No newline at end of file
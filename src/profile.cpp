@@ -0,0 +1,120 @@
+#include "profile.h"
+
+void profile_t::record(const op_decoded_t* inst, int idx, unsigned long long elapsed) {
+    counts[inst->type]++;
+    ticks[inst->type] += elapsed;
+    pc_counts[idx]++;
+}
+
+void profile_t::record_jump(int target) {
+    if (target >= 0 && target < length) {
+        jump_counts[target]++;
+    }
+}
+
+profile_t* create_profile(int length, bool json) {
+    profile_t* profile = (profile_t*)malloc(sizeof(profile_t));
+    if (profile == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for profile_t");
+        return NULL;
+    }
+
+    memset(profile, 0, sizeof(profile_t));
+    profile->json = json;
+    profile->length = length;
+    profile->pc_counts = (unsigned long long*)calloc(length + 1, sizeof(unsigned long long));
+    profile->jump_counts = (unsigned long long*)calloc(length + 1, sizeof(unsigned long long));
+    return profile;
+}
+
+void free_profile(profile_t* profile) {
+    if (profile == NULL)
+        return;
+
+    free(profile->pc_counts);
+    free(profile->jump_counts);
+    free(profile);
+}
+
+// indices of the 'limit' largest non-zero entries, largest first
+static int top_entries(const unsigned long long* values, int length, int* out, int limit) {
+    int count = 0;
+    for (int i = 0; i < length; ++i) {
+        if (values[i] == 0)
+            continue;
+
+        int at;
+        if (count < limit) at = count++;
+        else if (values[i] > values[out[limit - 1]]) at = limit - 1;
+        else continue;
+
+        while (at > 0 && values[out[at - 1]] < values[i]) {
+            out[at] = out[at - 1];
+            at--;
+        }
+        out[at] = i;
+    }
+    return count;
+}
+
+void print_profile(const profile_t* profile, const op_decoded_program_t* program) {
+    unsigned long long total_count = 0;
+    unsigned long long total_ticks = 0;
+    for (int i = 0; i < 256; ++i) {
+        total_count += profile->counts[i];
+        total_ticks += profile->ticks[i];
+    }
+
+    int hot_pcs[PROFILE_HOT_PCS];
+    int hot_jumps[PROFILE_HOT_PCS];
+    const int hot_pc_count = top_entries(profile->pc_counts, profile->length, hot_pcs, PROFILE_HOT_PCS);
+    const int hot_jump_count = top_entries(profile->jump_counts, profile->length, hot_jumps, PROFILE_HOT_PCS);
+
+    if (profile->json) {
+        printf("{\"instructions\":%llu,\"ticks\":%llu,\"opcodes\":[", total_count, total_ticks);
+        bool first = true;
+        for (int i = 0; i < 256; ++i) {
+            if (profile->counts[i] == 0)
+                continue;
+            printf("%s{\"opcode\":\"%s\",\"id\":%d,\"count\":%llu,\"ticks\":%llu}",
+                   first ? "" : ",", op_name(i), i, profile->counts[i], profile->ticks[i]);
+            first = false;
+        }
+        printf("],\"hot_pcs\":[");
+        for (int i = 0; i < hot_pc_count; ++i) {
+            const op_decoded_t* inst = &program->instructions[hot_pcs[i]];
+            printf("%s{\"offset\":%d,\"opcode\":\"%s\",\"count\":%llu}",
+                   i == 0 ? "" : ",", inst->offset, op_name(inst->type), profile->pc_counts[hot_pcs[i]]);
+        }
+        printf("],\"jump_targets\":[");
+        for (int i = 0; i < hot_jump_count; ++i) {
+            printf("%s{\"offset\":%d,\"count\":%llu}",
+                   i == 0 ? "" : ",", program->instructions[hot_jumps[i]].offset, profile->jump_counts[hot_jumps[i]]);
+        }
+        printf("]}\n");
+        return;
+    }
+
+    printf("======= PROFILE (%llu instructions, %llu ticks) =======\n", total_count, total_ticks);
+    printf("%-8s %14s %7s %16s %7s %12s\n", "opcode", "count", "%", "ticks", "%", "ticks/inst");
+    for (int i = 0; i < 256; ++i) {
+        if (profile->counts[i] == 0)
+            continue;
+        printf("%-8s %14llu %6.2f%% %16llu %6.2f%% %12.2f\n", op_name(i),
+               profile->counts[i], 100.0 * profile->counts[i] / total_count,
+               profile->ticks[i], total_ticks ? 100.0 * profile->ticks[i] / total_ticks : 0.0,
+               (double)profile->ticks[i] / profile->counts[i]);
+    }
+
+    printf("------- hot offsets -------\n");
+    for (int i = 0; i < hot_pc_count; ++i) {
+        const op_decoded_t* inst = &program->instructions[hot_pcs[i]];
+        printf("0x%08X %-8s %14llu\n", inst->offset, op_name(inst->type), profile->pc_counts[hot_pcs[i]]);
+    }
+
+    printf("------- jump targets -------\n");
+    for (int i = 0; i < hot_jump_count; ++i) {
+        printf("0x%08X %14llu\n", program->instructions[hot_jumps[i]].offset, profile->jump_counts[hot_jumps[i]]);
+    }
+    printf("===============================================\n");
+}
\ No newline at end of file
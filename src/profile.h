@@ -0,0 +1,32 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "opcodes.h"
+#include "decoder.h"
+
+static constexpr int PROFILE_HOT_PCS = 16;                 // how many offsets the report lists
+
+// filled in by cpu_t::execute_profiled(). times are in trace_timestamp()
+// ticks (tsc on x86-64) and include the dispatch around each instruction.
+typedef struct profile_t {
+  bool json;
+  int length;                               // instructions in the decoded program
+  unsigned long long counts[256];           // per op_type_t
+  unsigned long long ticks[256];
+  unsigned long long* pc_counts;            // per decoded instruction
+  unsigned long long* jump_counts;          // per decoded instruction, times it was a taken jump target
+
+  void record(const op_decoded_t* inst, int idx, unsigned long long elapsed);
+  void record_jump(int target);
+};
+
+profile_t* create_profile(int length, bool json);
+void free_profile(profile_t* profile);
+
+// table (or json) of per-opcode counts/time, the hottest bytecode
+// offsets and the most taken jump targets
+void print_profile(const profile_t* profile, const op_decoded_program_t* program);
+
+#endif // __PROFILE_H__
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "scheduler.h"
+#include "cpu.h"
+
+scheduler_t* create_scheduler(unsigned int quantum) {
+    scheduler_t* scheduler = (scheduler_t*)malloc(sizeof(scheduler_t));
+    if (scheduler == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for scheduler_t");
+        return NULL;
+    }
+
+    scheduler->ring = NULL;
+    scheduler->head = 0;
+    scheduler->count = 0;
+    scheduler->capacity = 0;
+    scheduler->quantum = quantum > 0 ? quantum : SCHEDULER_DEFAULT_QUANTUM;
+    scheduler->slices = 0;
+    return scheduler;
+}
+
+void free_scheduler(scheduler_t* scheduler) {
+    if (scheduler == NULL)
+        return;
+
+    free(scheduler->ring);
+    free(scheduler);
+}
+
+bool scheduler_t::add(cpu_t* cpu) {
+    if (count == capacity) {
+        const int grown = capacity == 0 ? 16 : capacity * 2;
+        cpu_t** resized = (cpu_t**)malloc(sizeof(cpu_t*) * grown);
+        if (resized == NULL) {
+            LOG_ERROR("[-] Failed to grow scheduler ring");
+            return false;
+        }
+
+        // unwrap into the new ring so 'head' starts over at 0
+        for (int i = 0; i < count; ++i) {
+            resized[i] = ring[(head + i) % capacity];
+        }
+        free(ring);
+        ring = resized;
+        head = 0;
+        capacity = grown;
+    }
+
+    ring[(head + count) % capacity] = cpu;
+    count++;
+    return true;
+}
+
+cpu_t* scheduler_t::step() {
+    if (count == 0)
+        return NULL;
+
+    cpu_t* cpu = ring[head];
+    head = (head + 1) % capacity;
+    count--;
+
+    slices++;
+    if (cpu->run_for(quantum) == CPU_HALTED) {
+        return cpu;
+    }
+
+    ring[(head + count) % capacity] = cpu;
+    count++;
+    return NULL;
+}
+
+int scheduler_t::run_until(std::chrono::steady_clock::time_point deadline) {
+    // one clock read per full round rather than per slice
+    while (count > 0 && std::chrono::steady_clock::now() < deadline) {
+        for (int i = count; i > 0 && count > 0; --i) {
+            step();
+        }
+    }
+    return count;
+}
+
+int scheduler_t::run() {
+    while (count > 0) {
+        step();
+    }
+    return count;
+}
\ No newline at end of file
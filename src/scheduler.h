@@ -0,0 +1,35 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "machine.h"
+
+#include <chrono>
+
+struct cpu_t;
+
+static constexpr unsigned int SCHEDULER_DEFAULT_QUANTUM = 10000;
+
+// round-robin over many cpus on the calling thread. each turn gives the cpu
+// at the front one run_for(quantum) slice, a cpu that yields goes to the back
+// of the ring and one that halts is dropped. latency for every tenant is
+// bounded by (runnable cpus) x (quantum + one basic block).
+typedef struct scheduler_t {
+  cpu_t** ring;                             // runnable cpus, 'count' of them starting at 'head'
+  int head;
+  int count;
+  int capacity;
+  unsigned int quantum;
+  unsigned long long slices;                // run_for() calls made so far
+
+  bool add(cpu_t* cpu);
+  cpu_t* step();                            // one slice, returns the cpu if it halted (NULL otherwise)
+  int run_until(std::chrono::steady_clock::time_point deadline);
+  int run();                                // until every cpu halted
+};
+
+scheduler_t* create_scheduler(unsigned int quantum);
+void free_scheduler(scheduler_t* scheduler);
+
+#endif // __SCHEDULER_H__
\ No newline at end of file
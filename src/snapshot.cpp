@@ -0,0 +1,18 @@
+#include "snapshot.h"
+
+void free_snapshot(cpu_snapshot_t* snapshot) {
+    if (snapshot == NULL)
+        return;
+
+    free_page_image(snapshot->pages);
+    if (snapshot->owns_jit) {
+        jit_free(snapshot->jit);
+    }
+    if (snapshot->owns_aot) {
+        aot_free(snapshot->aot);
+    }
+    if (snapshot->owns_decoded) {
+        free_decoded_program(snapshot->decoded);
+    }
+    free(snapshot);
+}
\ No newline at end of file
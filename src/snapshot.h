@@ -0,0 +1,39 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "ilbuilder.h"
+#include "decoder.h"
+#include "machine.h"
+#include "jit.h"
+#include "aot.h"
+#include "interrupt.h"
+#include "heap.h"
+#include "pages.h"
+
+// everything cpu_t::fork() and cpu_t::restore() need to put a cpu back in
+// the state cpu_t::snapshot() saw. the snapshot owns the decoded/jit'd/aot code
+// from then on, every cpu running from it (the source included) only borrows
+// it, so it has to outlive all of them.
+typedef struct cpu_snapshot_t {
+  page_image_t* pages;                      // guest memory and heap tables, see pages.h
+  unsigned int memory_size;
+  op_program_t* program;
+  op_decoded_program_t* decoded;
+  jit_program_t* jit;
+  aot_program_t* aot;
+  const interrupt_table_t* interrupts;      // not owned, like the cpu's
+  bool owns_decoded;                        // false when the source cpu was itself borrowing its code
+  bool owns_jit;
+  bool owns_aot;
+  cpu_info_t info;
+  cpu_engine_t engine;
+  int resume_at;
+  unsigned int registers[REGISTER_SIZE];
+  heap_t heap;                              // table pointers still point into the source cpu
+};
+
+void free_snapshot(cpu_snapshot_t* snapshot);
+
+#endif // __SNAPSHOT_H__
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include "trace.h"
+
+#include <chrono>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+bool trace_enabled = false;
+trace_ring_t trace_ring;
+
+typedef struct trace_file_header_t {
+  unsigned int magic;
+  unsigned int event_size;
+  unsigned long long count;
+};
+
+unsigned long long trace_timestamp() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static const char* trace_kind_name(unsigned int kind) {
+    switch (kind) {
+        case TRACE_EXECUTE: return "execute";
+        case TRACE_UNKNOWN: return "unknown";
+        case TRACE_JIT_EXIT: return "jit-exit";
+    }
+    return "?";
+}
+
+void trace_enable(bool enabled) {
+    trace_enabled = enabled;
+}
+
+void trace_reset() {
+    trace_ring.head.store(0, std::memory_order_relaxed);
+}
+
+void trace_record(trace_kind_t kind, unsigned int pc, unsigned int arg) {
+    const unsigned long long sequence = trace_ring.head.fetch_add(1, std::memory_order_relaxed);
+    trace_event_t* event = &trace_ring.events[sequence & (TRACE_CAPACITY - 1)];
+    event->sequence = sequence;
+    event->timestamp = trace_timestamp();
+    event->kind = kind;
+    event->pc = pc;
+    event->arg = arg;
+    event->reserved = 0;
+}
+
+// oldest event still in the ring and how many there are
+static unsigned long long trace_window(unsigned long long* first) {
+    const unsigned long long head = trace_ring.head.load(std::memory_order_acquire);
+    const unsigned long long count = std::min<unsigned long long>(head, TRACE_CAPACITY);
+    (*first) = head - count;
+    return count;
+}
+
+static void trace_print_event(const trace_event_t* event) {
+    printf("%12llu %20llu %-9s pc=0x%08X arg=0x%X\n",
+           event->sequence, event->timestamp, trace_kind_name(event->kind), event->pc, event->arg);
+}
+
+bool trace_dump(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG_ERROR("[-] Failed to open trace file: " << path);
+        return false;
+    }
+
+    unsigned long long first;
+    const unsigned long long count = trace_window(&first);
+    trace_file_header_t header = { TRACE_MAGIC, sizeof(trace_event_t), count };
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (unsigned long long i = first; i < first + count; ++i) {
+        fwrite(&trace_ring.events[i & (TRACE_CAPACITY - 1)], sizeof(trace_event_t), 1, file);
+    }
+
+    fclose(file);
+    LOG_MSG("[+] Wrote " << count << " trace events to " << path);
+    return true;
+}
+
+bool trace_decode(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        LOG_ERROR("[-] Failed to open trace file: " << path);
+        return false;
+    }
+
+    trace_file_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != TRACE_MAGIC || header.event_size != sizeof(trace_event_t)) {
+        LOG_ERROR("[-] Not a trace file: " << path);
+        fclose(file);
+        return false;
+    }
+
+    trace_event_t event;
+    for (unsigned long long i = 0; i < header.count && fread(&event, sizeof(event), 1, file) == 1; ++i) {
+        trace_print_event(&event);
+    }
+
+    fclose(file);
+    return true;
+}
+
+void trace_print() {
+    unsigned long long first;
+    const unsigned long long count = trace_window(&first);
+    for (unsigned long long i = first; i < first + count; ++i) {
+        trace_print_event(&trace_ring.events[i & (TRACE_CAPACITY - 1)]);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "stdafx.h"
+#include "log.h"
+
+#include <atomic>
+
+// hot-path events (one per executed instruction, ...) go into a fixed-size
+// binary ring instead of stdout. recording is off until trace_enable(), and
+// while off a TRACE_EVENT is one predictable branch on a global flag.
+// -DCEMU_TRACE=0 removes even that.
+#ifndef CEMU_TRACE
+#define CEMU_TRACE 1
+#endif
+
+static constexpr size_t TRACE_CAPACITY = 1 << 16;          // must be a power of two
+static constexpr unsigned int TRACE_MAGIC = 0x43545243;    // "CRTC"
+
+enum trace_kind_t : unsigned int {
+    TRACE_EXECUTE       = 0x01,                            // pc = bytecode offset, arg = opcode
+    TRACE_UNKNOWN       = 0x02,                            // pc = bytecode offset, arg = opcode
+    TRACE_JIT_EXIT      = 0x03,                            // pc = instruction index jit'd (or aot) code returned at
+};
+
+typedef struct trace_event_t {
+  unsigned long long sequence;
+  unsigned long long timestamp;                            // tsc on x86-64, steady_clock ns elsewhere
+  unsigned int kind;
+  unsigned int pc;
+  unsigned int arg;
+  unsigned int reserved;
+};
+
+// slots are claimed with one fetch_add, so any number of threads can
+// record at once without locking. a reader should only look at the
+// ring once writers are done (end of a run).
+typedef struct trace_ring_t {
+  std::atomic<unsigned long long> head;
+  trace_event_t events[TRACE_CAPACITY];
+};
+
+extern bool trace_enabled;
+extern trace_ring_t trace_ring;
+
+void trace_enable(bool enabled);
+void trace_reset();
+void trace_record(trace_kind_t kind, unsigned int pc, unsigned int arg);
+unsigned long long trace_timestamp();
+
+bool trace_dump(const char* path);                         // raw events, oldest first
+bool trace_decode(const char* path);                       // prints a file written by trace_dump()
+void trace_print();                                        // prints what's currently in the ring
+
+#if CEMU_TRACE
+#define TRACE_EVENT(kind, pc, arg)                                          \
+    do {                                                                    \
+        if (__builtin_expect(trace_enabled, 0)) {                           \
+            trace_record((kind), (pc), (arg));                              \
+        }                                                                   \
+    } while (0)
+#else
+#define TRACE_EVENT(kind, pc, arg) do { } while (0)
+#endif
+
+#endif // __TRACE_H__
\ No newline at end of file
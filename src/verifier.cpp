@@ -0,0 +1,199 @@
+#include "verifier.h"
+
+static constexpr int STACK_SLOT = sizeof(int);
+
+static bool fail(verify_report_t* report, int idx, const char* reason) {
+    report->verified = false;
+    report->failed_at = idx;
+    report->reason = reason;
+    return false;
+}
+
+static bool is_register(int operand) {
+    return operand >= 0 && operand < REGISTER_SIZE;
+}
+
+// a register the instruction writes, SP would break the stack depths
+static bool is_writable_register(int operand) {
+    return is_register(operand) && operand != SP;
+}
+
+// operand checks and the SP effect of one instruction, the rules mirror
+// the handlers in cpu_t::execute_inst(). 'depth' is SP before it runs.
+static const char* check_instruction(const op_decoded_t* inst, int depth, int* next_depth) {
+    (*next_depth) = depth;
+
+    switch (inst->type) {
+        case PUSH: {
+            if (inst->length != 1) return "PUSH takes 1 operand";
+            if (depth + STACK_SLOT > STACK_SIZE) return "stack overflow";
+            (*next_depth) = depth + STACK_SLOT;
+            return NULL;
+        }
+
+        case POP: {
+            if (inst->length != 1) return "POP takes 1 operand";
+            if (!is_writable_register(inst->operands[0])) return "bad register operand";
+            if (depth < STACK_SLOT) return "stack underflow";
+            (*next_depth) = depth - STACK_SLOT;
+            return NULL;
+        }
+
+        case MOVI: {
+            if (inst->length != 2) return "MOVI takes 2 operands";
+            if (!is_writable_register(inst->operands[0])) return "bad register operand";
+            if (depth >= STACK_SIZE) return "stack overflow";              // a full stack replays PUSH; POP
+            return NULL;
+        }
+
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case AND:
+        case OR:
+        case XOR: {
+            if (inst->length != 2) return "ALU instructions take 2 operands";
+            if (!is_writable_register(inst->operands[0]) || !is_register(inst->operands[1])) return "bad register operand";
+            return NULL;
+        }
+
+        case ADDI:
+        case SUBI:
+        case MULI:
+        case DIVI:
+        case ANDI:
+        case ORI:
+        case XORI: {
+            if (inst->length != 2) return "ALU instructions take 2 operands";
+            if (!is_writable_register(inst->operands[0])) return "bad register operand";
+            if (inst->type == DIVI && inst->operands[1] == 0) return "division by zero";
+            return NULL;
+        }
+
+        // the address is only known at run time, the engines bounds-check it
+        case LOAD: {
+            if (inst->length != 3) return "LOAD takes 3 operands";
+            if (!is_writable_register(inst->operands[0]) || !is_register(inst->operands[1])) return "bad register operand";
+            return NULL;
+        }
+
+        case STORE: {
+            if (inst->length != 3) return "STORE takes 3 operands";
+            if (!is_register(inst->operands[0]) || !is_register(inst->operands[1])) return "bad register operand";
+            return NULL;
+        }
+
+        case CMP: {
+            if (inst->length != 2) return "CMP takes 2 operands";
+            if (!is_register(inst->operands[0]) || !is_register(inst->operands[1])) return "bad register operand";
+            return NULL;
+        }
+
+        case JMP:
+        case JE:
+        case JNE: {
+            if (inst->length != 1) return "jumps take 1 operand";
+            if (inst->target < 0) return "jump target is not an instruction boundary";
+            return NULL;
+        }
+
+        case CMPJE:
+        case CMPJNE: {
+            if (inst->length != 3) return "fused compare-and-jumps take 3 operands";
+            if (!is_register(inst->operands[0]) || !is_register(inst->operands[1])) return "bad register operand";
+            if (inst->target < 0) return "jump target is not an instruction boundary";
+            return NULL;
+        }
+
+        // handlers may change registers, never SP
+        case INT: {
+            if (inst->length != 1) return "INT takes 1 operand";
+            return NULL;
+        }
+    }
+
+    // no handler, the engines log it and move on without touching anything
+    return NULL;
+}
+
+bool verify_program(op_decoded_program_t* program, verify_report_t* report) {
+    memset(report, 0, sizeof(verify_report_t));
+    report->failed_at = -1;
+    program->verified = false;
+    free(program->stack_depths);
+    program->stack_depths = NULL;
+
+    const int length = program->length;
+    int* depths = (int*)malloc(sizeof(int) * (length + 1));
+    int* worklist = (int*)malloc(sizeof(int) * (length + 1));
+    if (depths == NULL || worklist == NULL) {
+        LOG_ERROR("[-] Failed to allocate memory for the verifier");
+        free(depths);
+        free(worklist);
+        return fail(report, -1, "out of memory");
+    }
+
+    for (int i = 0; i <= length; ++i) {
+        depths[i] = -1;
+    }
+
+    // every instruction is queued once, when its depth is first known. a
+    // second path into it only has to agree with that depth
+    int pending = 0;
+    depths[0] = 0;
+    worklist[pending++] = 0;
+
+    bool ok = true;
+    while (ok && pending > 0) {
+        const int idx = worklist[--pending];
+        if (idx == length)
+            continue;
+
+        const op_decoded_t* inst = &program->instructions[idx];
+        const int depth = depths[idx];
+        report->reachable++;
+        report->max_stack_depth = std::max(report->max_stack_depth, depth);
+
+        int next_depth;
+        const char* reason = check_instruction(inst, depth, &next_depth);
+        if (reason != NULL) {
+            ok = fail(report, idx, reason);
+            break;
+        }
+
+        // a conditional jump goes both ways, JMP only to its target
+        int successors[2];
+        int successor_count = 0;
+        if (inst->type != JMP) {
+            successors[successor_count++] = inst->next;
+        }
+        if (jump_operand(inst->type) >= 0) {
+            successors[successor_count++] = inst->target;
+        }
+
+        for (int i = 0; ok && i < successor_count; ++i) {
+            const int successor = successors[i];
+            if (successor < 0 || successor > length) {
+                ok = fail(report, idx, "successor outside the program");
+            } else if (depths[successor] < 0) {
+                depths[successor] = next_depth;
+                worklist[pending++] = successor;
+            } else if (depths[successor] != next_depth) {
+                ok = fail(report, successor, "stack depth differs between paths");
+            }
+        }
+    }
+    free(worklist);
+
+    if (!ok) {
+        free(depths);
+        return false;
+    }
+
+    report->verified = true;
+    report->max_stack_depth = std::max(report->max_stack_depth, depths[length]);
+    program->verified = true;
+    program->stack_depths = depths;
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef __VERIFIER_H__
+#define __VERIFIER_H__
+
+#include "stdafx.h"
+#include "log.h"
+#include "opcodes.h"
+#include "decoder.h"
+#include "machine.h"
+
+// load-time proof that a decoded program can't step outside the cpu, done
+// once so the engines don't have to re-check it on every instruction:
+//
+//   - every instruction with a handler has the operand count it expects
+//   - register operands index 'registers', and none of them writes SP
+//   - every jump lands on an instruction boundary (or the end), and a
+//     conditional one is followed both ways
+//   - SP is the same on every path into an instruction, and stays in
+//     [0, STACK_SIZE] without a PUSH overflowing or a POP underflowing
+//
+// a verified program gets 'verified' and 'stack_depths' set, and the
+// switch and threaded engines run it without their per-step checks. the
+// depth at the instruction a run resumes at is compared against SP once
+// per slice, so a host that moves SP behind the program's back only falls
+// back to the checked engine. anything the verifier doesn't know is left
+// to the checked engines, so a new opcode handler has to be taught here first.
+typedef struct verify_report_t {
+  bool verified;
+  int failed_at;                            // instruction index, -1 when verified
+  const char* reason;                       // why it failed, NULL when verified
+  int max_stack_depth;                      // bytes, over every reachable instruction
+  int reachable;                            // instructions reachable from the first one
+};
+
+bool verify_program(op_decoded_program_t* program, verify_report_t* report);
+
+#endif // __VERIFIER_H__